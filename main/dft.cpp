@@ -6,13 +6,16 @@
  */
 
 #include "dft.h"
+#include "dft_split.h"
+#include "threads.h"
+#include "trace.h"
 #include <math.h>
 #include <complex>
 #include <algorithm>
-#include <stack>
 using namespace std;
 
-#define PI 3.14159265
+#define PI 3.14159265358979323846
+#define FFT_SCRATCH 0   // thread_scratch() slot of the row and column buffers
 
 /*
  * "Butterfly" transform.
@@ -25,17 +28,17 @@ inline void butterfly(comp &x, comp &y, comp w)
 }
 
 /*
- * Series of butterfly transforms required by the FFT algorithm.
+ * Series of butterfly transforms required by the FFT algorithm.  The powers
+ * of the root are taken from the plan table with the given stride, so no
+ * error accumulates along the series.
  */
-inline void mass_butterfly(comp *array, int size, comp w)
+inline void mass_butterfly(comp *array, int size, const comp *roots,
+                           int stride)
 {
-   comp power(1.0, 0.0);
    int n = size/2;
    
-   for(int i = 0; i < n; i++) {
-      butterfly(array[i], array[i+n], power);
-      power *= w;
-   }
+   for(int i = 0; i < n; i++)
+      butterfly(array[i], array[i+n], roots[i*stride]);
 }
 
 /*
@@ -60,62 +63,134 @@ inline unsigned int backwards(unsigned int x, int length)
 
 /*
  * Moves elements of the array as required by the iterative FFT implementation.
+ */
+static void reposition(comp *array, const FFT_PLAN *plan)
+{
+   // Swap elements at positions k and reverse(k)
+   for(int i = 0; i < plan->size; i++) {
+      int j = plan->reversed[i];
+      if(i < j)
+         swap(array[i], array[j]);
+   }
+}
+
+/*
+ * Builds the bit reversal and root tables for transforms of size ``size''.
  * ``size'' must be a power of 2.
  */
-static void reposition(comp *array, int size)
+FFT_PLAN *create_fft_plan(int size)
 {
    // Determine the bit length
    int length = 0;
    while(1u << length < (unsigned int)size)
       length++;
 
-   // Swap elements at positions k and reverse(k)
-   for(int i = 0; i < size; i++) {
-      int j = backwards(i, length);
-      if(i <= j)
-         swap(array[i], array[j]);
+   FFT_PLAN *plan = new FFT_PLAN;
+   plan->size = size;
+   plan->reversed = new unsigned int[size];
+   for(int i = 0; i < size; i++)
+      plan->reversed[i] = length > 0 ? backwards(i, length) : 0;
+
+   // Every root is computed directly rather than by repeated multiplication
+   int n = size/2 > 0 ? size/2 : 1;
+   plan->roots = new comp[n];
+   for(int k = 0; k < n; k++)
+      plan->roots[k] = comp(cos(2.0*PI*k/size), sin(2.0*PI*k/size));
+
+   // Roots of the pass with blocks of 2m are stored contiguously from m on
+   plan->twiddle_re = new double[size];
+   plan->twiddle_im = new double[size];
+   plan->twiddle_re[0] = 1.0;
+   plan->twiddle_im[0] = 0.0;
+   for(int m = 1; m < size; m *= 2) {
+      for(int k = 0; k < m; k++) {
+         comp root = plan->roots[k*(size/(2*m))];
+         plan->twiddle_re[m + k] = root.real();
+         plan->twiddle_im[m + k] = root.imag();
+      }
    }
+   return plan;
+}
+
+/*
+ * Frees the tables of a plan.
+ */
+void delete_fft_plan(FFT_PLAN *plan)
+{
+   if(plan == 0)
+      return;
+   delete[] plan->reversed;
+   delete[] plan->roots;
+   delete[] plan->twiddle_re;
+   delete[] plan->twiddle_im;
+   delete plan;
+}
+
+/*
+ * Plans live in a table indexed by the bit length of their size and are kept
+ * until the program exits.  The lock only guards the creation; a plan found
+ * in the table is complete.
+ */
+static FFT_PLAN *plan_cache[32];
+static MUTEX plan_lock;
+
+FFT_PLAN *get_fft_plan(int size)
+{
+   int length = 0;
+   while(1u << length < (unsigned int)size)
+      length++;
+   plan_lock.lock();
+   if(plan_cache[length] == 0)
+      plan_cache[length] = create_fft_plan(size);
+   FFT_PLAN *plan = plan_cache[length];
+   plan_lock.unlock();
+   return plan;
 }
 
 /*
  * Does the Discrete Fourier Transform.  Takes time O(size * log(size)).
- * ``size'' must be a power of 2.
  */
-void fourier_transform(comp *array, int size)
+void fourier_transform(comp *array, const FFT_PLAN *plan)
 {
+   int size = plan->size;
+
    // Arrange numbers in a convenient order
-   reposition(array, size);
-
-   // Prepare roots of unity for every step
-   int step;
-   comp root = exp(comp(0.0, 2.0*PI/size));
-   stack<comp> roots;
-   for(step=size; step != 1; step /= 2) {
-      roots.push(root);
-      root *= root;
-   }
+   reposition(array, plan);
 
-   // Do lots of butterfly transforms
-   for(step = 2; step <= size; step *= 2) {
-      root = roots.top();
-      roots.pop();
+   // Do lots of butterfly transforms.  The root of step ``step'' is the
+   // (size/step)-th root in the table
+   for(int step = 2; step <= size; step *= 2) {
       for(int i = 0; i < size; i += step)   
-         mass_butterfly(array + i, step, root);
+         mass_butterfly(array + i, step, plan->roots, size/step);
    }
 }
 
+/*
+ * ``size'' must be a power of 2.
+ */
+void fourier_transform(comp *array, int size)
+{
+   fourier_transform(array, get_fft_plan(size));
+}
+
 /*
  * The inverse DFT.
  */
-void inverse_fourier_transform(comp *array, int size)
+void inverse_fourier_transform(comp *array, const FFT_PLAN *plan)
 {
+   int size = plan->size;
    conjugate(array, size);
-   fourier_transform(array, size);
+   fourier_transform(array, plan);
    conjugate(array, size);
    for(int i = 0; i < size; i++)
       array[i] = array[i] / (double)size;
 }
 
+void inverse_fourier_transform(comp *array, int size)
+{
+   inverse_fourier_transform(array, get_fft_plan(size));
+}
+
 /*
  * Replaces every element of the vector by its complex conjugate.
  */
@@ -128,10 +203,277 @@ void conjugate(comp *array, int size)
 /*
  * Multiplies two vectors element by element.
  */
+struct PRODUCT {
+   comp *arr1, *arr2, *result;
+};
+
+static void multiply_range(void *context, int begin, int end)
+{
+   PRODUCT *product = (PRODUCT *)context;
+   for(int i = begin; i < end; i++)
+      product->result[i] = product->arr1[i] * product->arr2[i];
+}
+
 void multiply(comp *arr1, comp *arr2, comp *result, int size)
 {
-   for(int i = 0; i < size; i++)
-      result[i] = arr1[i] * arr2[i];
+   PRODUCT product = { arr1, arr2, result };
+   parallel_for(size, multiply_range, &product);
+}
+
+/*
+ * Returns the smallest power of 2 not less than n + m - 1, i.e. the smallest
+ * size of a cyclic convolution which equals the linear convolution of two
+ * vectors of lengths n and m.  Every axis of a 2D array is padded separately.
+ */
+int convolution_size(int n, int m)
+{
+   int size = 1;
+   while(size < n + m - 1)
+      size *= 2;
+   return size;
+}
+
+/*
+ * One pass of a 2D transform.  The rows or columns of a pass are
+ * independent, so they are spread over the thread pool.
+ */
+struct PASS {
+   comp *array;            // Complex array, ``width'' numbers per row
+   const double *input;    // Real rows of a forward real transform
+   double *output;         // Real rows of an inverse real transform
+   int width, height;      // Size of the complex array
+   int size;               // Length of a real row
+   bool inverse;
+   const FFT_PLAN *plan;      // Plan of the complex rows or columns
+   const FFT_PLAN *real_plan; // Plans of the real rows: ``size'' and size/2,
+   const FFT_PLAN *half_plan; // looked up once per transform, not per row
+};
+
+/*
+ * Transforms columns begin ... end - 1.  Every column is copied into a
+ * split-complex buffer, so the transform runs on sequential memory with the
+ * SIMD kernels.
+ */
+static void column_range(void *context, int begin, int end)
+{
+   PASS *pass = (PASS *)context;
+   int width = pass->width, height = pass->height;
+   comp *array = pass->array;
+   double *re = (double *)thread_scratch(FFT_SCRATCH, 2*height*sizeof(double));
+   double *im = re + height;
+   for(int x = begin; x < end; x++) {
+      for(int y = 0; y < height; y++) {
+         re[y] = array[y*width + x].real();
+         im[y] = array[y*width + x].imag();
+      }
+      if(pass->inverse)
+         inverse_split_fourier_transform(re, im, pass->plan);
+      else
+         split_fourier_transform(re, im, pass->plan);
+      for(int y = 0; y < height; y++)
+         array[y*width + x] = comp(re[y], im[y]);
+   }
+}
+
+static void transform_columns(comp *array, int width, int height,
+                              bool inverse)
+{
+   PASS pass = { array, 0, 0, width, height, 0, inverse,
+                 get_fft_plan(height), 0, 0 };
+   parallel_for(width, column_range, &pass);
+}
+
+/*
+ * Transforms rows begin ... end - 1 of a complex array.
+ */
+static void row_range(void *context, int begin, int end)
+{
+   PASS *pass = (PASS *)context;
+   for(int y = begin; y < end; y++) {
+      if(pass->inverse)
+         inverse_fourier_transform(pass->array + y*pass->width, pass->plan);
+      else
+         fourier_transform(pass->array + y*pass->width, pass->plan);
+   }
+}
+
+/*
+ * Two-dimensional DFT: row passes followed by column passes.  Takes time
+ * O(width * height * log(width * height)).  ``width'' and ``height'' must be
+ * powers of 2.
+ */
+void fourier_transform_2d(comp *array, int width, int height)
+{
+   TRACE_SCOPE("fft");
+   TRACE_FFT(width*height, false);
+   PASS pass = { array, 0, 0, width, height, 0, false, get_fft_plan(width),
+                 0, 0 };
+   parallel_for(height, row_range, &pass);
+   transform_columns(array, width, height, false);
+}
+
+/*
+ * The inverse two-dimensional DFT.
+ */
+void inverse_fourier_transform_2d(comp *array, int width, int height)
+{
+   TRACE_SCOPE("inverse fft");
+   TRACE_FFT(width*height, false);
+   PASS pass = { array, 0, 0, width, height, 0, true, get_fft_plan(width),
+                 0, 0 };
+   parallel_for(height, row_range, &pass);
+   transform_columns(array, width, height, true);
+}
+
+/*
+ * Fourier transform of real numbers.  The even and odd numbers are packed
+ * into the real and imaginary parts of a complex array of half the size,
+ * which is transformed and then split into the spectra of both halves.
+ * Takes half the time and memory of the complex transform.  ``re'' and
+ * ``im'' are buffers of size/2 numbers; ``plan'' and ``half_plan'' are the
+ * plans of size and size/2.
+ */
+static void real_transform(const double *array, comp *result, int size,
+                           double *re, double *im, const FFT_PLAN *plan,
+                           const FFT_PLAN *half_plan)
+{
+   if(size == 1) {
+      result[0] = array[0];
+      return;
+   }
+
+   int n = size/2;
+   const comp *roots = plan->roots;
+   const comp half_i(0.0, -0.5);
+
+   for(int k = 0; k < n; k++) {
+      re[k] = array[2*k];
+      im[k] = array[2*k+1];
+   }
+   split_fourier_transform(re, im, half_plan);
+
+   // Coefficients k and n-k depend on the same pair of numbers
+   result[0] = re[0] + im[0];
+   result[n] = re[0] - im[0];
+   for(int k = 1; k <= n/2; k++) {
+      comp p(re[k], im[k]), q(re[n-k], im[n-k]);
+      comp even1 = (p + conj(q))*0.5, odd1 = (p - conj(q))*half_i;
+      comp even2 = (q + conj(p))*0.5, odd2 = (q - conj(p))*half_i;
+      result[k] = even1 + roots[k]*odd1;
+      result[n-k] = even2 + roots[n-k]*odd2;
+   }
+}
+
+void real_fourier_transform(const double *array, comp *result, int size)
+{
+   double *re = (double *)thread_scratch(FFT_SCRATCH,
+                                         2*(size/2 + 1)*sizeof(double));
+   double *im = re + size/2 + 1;
+   real_transform(array, result, size, re, im, get_fft_plan(size),
+                  (size > 1) ? get_fft_plan(size/2) : 0);
+}
+
+/*
+ * The inverse of real_fourier_transform().  Builds the packed half-size
+ * spectrum back and does one complex inverse transform of size/2.
+ */
+static void inverse_real_transform(const comp *spectrum, double *result,
+                                   int size, double *re, double *im,
+                                   const FFT_PLAN *plan,
+                                   const FFT_PLAN *half_plan)
+{
+   if(size == 1) {
+      result[0] = spectrum[0].real();
+      return;
+   }
+
+   int n = size/2;
+   const comp *roots = plan->roots;
+   const comp i(0.0, 1.0);
+
+   comp p = spectrum[0], q = spectrum[n];
+   comp packed = (p + conj(q))*0.5 + i*(p - conj(q))*0.5;
+   re[0] = packed.real();
+   im[0] = packed.imag();
+   for(int k = 1; k <= n/2; k++) {
+      p = spectrum[k];
+      q = spectrum[n-k];
+      comp even1 = (p + conj(q))*0.5, odd1 = (p - conj(q))*conj(roots[k])*0.5;
+      comp even2 = (q + conj(p))*0.5, odd2 = (q - conj(p))*conj(roots[n-k])*0.5;
+      packed = even1 + i*odd1;
+      re[k] = packed.real();
+      im[k] = packed.imag();
+      packed = even2 + i*odd2;
+      re[n-k] = packed.real();
+      im[n-k] = packed.imag();
+   }
+   inverse_split_fourier_transform(re, im, half_plan);
+
+   for(int k = 0; k < n; k++) {
+      result[2*k] = re[k];
+      result[2*k+1] = im[k];
+   }
+}
+
+void inverse_real_fourier_transform(const comp *spectrum, double *result,
+                                    int size)
+{
+   double *re = (double *)thread_scratch(FFT_SCRATCH,
+                                         2*(size/2 + 1)*sizeof(double));
+   double *im = re + size/2 + 1;
+   inverse_real_transform(spectrum, result, size, re, im, get_fft_plan(size),
+                          (size > 1) ? get_fft_plan(size/2) : 0);
+}
+
+/*
+ * Real row passes of the 2D transforms: rows begin ... end - 1.
+ */
+static void real_row_range(void *context, int begin, int end)
+{
+   PASS *pass = (PASS *)context;
+   int half = pass->width, size = pass->size;
+   double *re = (double *)thread_scratch(FFT_SCRATCH, 2*half*sizeof(double));
+   double *im = re + half;
+   for(int y = begin; y < end; y++) {
+      if(pass->inverse)
+         inverse_real_transform(pass->array + y*half, pass->output + y*size,
+                                size, re, im, pass->real_plan,
+                                pass->half_plan);
+      else
+         real_transform(pass->input + y*size, pass->array + y*half, size,
+                        re, im, pass->real_plan, pass->half_plan);
+   }
+}
+
+/*
+ * Two-dimensional DFT of real numbers: real row passes followed by complex
+ * column passes over the width/2 + 1 non-redundant columns.
+ */
+void real_fourier_transform_2d(const double *array, comp *result,
+                               int width, int height)
+{
+   TRACE_SCOPE("real fft");
+   TRACE_FFT(width*height, true);
+   int half = width/2 + 1;
+   PASS pass = { result, array, 0, half, height, width, false, 0,
+                 get_fft_plan(width), (width > 1) ? get_fft_plan(width/2) : 0 };
+   parallel_for(height, real_row_range, &pass);
+   transform_columns(result, half, height, false);
+}
+
+/*
+ * The inverse of real_fourier_transform_2d().
+ */
+void inverse_real_fourier_transform_2d(comp *spectrum, double *result,
+                                       int width, int height)
+{
+   TRACE_SCOPE("inverse real fft");
+   TRACE_FFT(width*height, true);
+   int half = width/2 + 1;
+   PASS pass = { spectrum, 0, result, half, height, width, true, 0,
+                 get_fft_plan(width), (width > 1) ? get_fft_plan(width/2) : 0 };
+   transform_columns(spectrum, half, height, true);
+   parallel_for(height, real_row_range, &pass);
 }
 
 /*
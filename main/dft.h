@@ -13,6 +13,25 @@ using namespace std;
 
 typedef complex<double> comp;
 
+// Tables for the transforms of one size.  A plan is never changed after it
+// is created, so one plan may be used by several threads at once
+struct FFT_PLAN {
+   int size;               // Transform size, a power of 2
+   unsigned int *reversed; // Bit-reversed index of every position
+   comp *roots;            // roots[k] = exp(2*pi*i*k/size), k < size/2
+   double *twiddle_re;     // Roots of every pass of the split-complex
+   double *twiddle_im;     // transform: exp(pi*i*k/m) at index m + k
+};
+
+// Creates a plan for transforms of the given size (a power of 2)
+FFT_PLAN *create_fft_plan(int size);
+
+// Frees a plan made by create_fft_plan()
+void delete_fft_plan(FFT_PLAN *plan);
+
+// Returns the cached plan for the given size, creating it on first use
+FFT_PLAN *get_fft_plan(int size);
+
 // Gets the complex conjugate of every element 
 void conjugate(comp *array, int size);
 
@@ -24,8 +43,37 @@ void convolution(comp *arr1, comp *arr2, comp *result, int size);
 
 // Discrete fourier transform. size must be a power of 2
 void fourier_transform(comp *array, int size);
+void fourier_transform(comp *array, const FFT_PLAN *plan);
 
 // Inverse fourier transform. size must be a power of 2
 void inverse_fourier_transform(comp *array, int size);
+void inverse_fourier_transform(comp *array, const FFT_PLAN *plan);
+
+// Smallest power of 2 which holds the linear convolution of lengths n and m
+int convolution_size(int n, int m);
+
+// Two-dimensional fourier transform of a width x height array stored row by
+// row. width and height must be powers of 2
+void fourier_transform_2d(comp *array, int width, int height);
+
+// Inverse two-dimensional fourier transform
+void inverse_fourier_transform_2d(comp *array, int width, int height);
+
+// Fourier transform of ``size'' real numbers. Writes the size/2 + 1
+// non-redundant coefficients into ``result''. size must be a power of 2
+void real_fourier_transform(const double *array, comp *result, int size);
+
+// Inverse of real_fourier_transform()
+void inverse_real_fourier_transform(const comp *spectrum, double *result,
+                                    int size);
+
+// Fourier transform of a width x height real array. The result holds
+// height rows of width/2 + 1 coefficients each
+void real_fourier_transform_2d(const double *array, comp *result,
+                               int width, int height);
+
+// Inverse of real_fourier_transform_2d(). Destroys ``spectrum''
+void inverse_real_fourier_transform_2d(comp *spectrum, double *result,
+                                       int width, int height);
 
 #endif
\ No newline at end of file
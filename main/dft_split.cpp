@@ -0,0 +1,430 @@
+/*
+ * Fast Fourier Transform on split-complex arrays (implementation)
+ */
+
+#include "dft_split.h"
+#include <math.h>
+#include <algorithm>
+using namespace std;
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define DFT_X86
+#include <emmintrin.h>
+#if defined(__GNUC__) || (defined(_MSC_VER) && _MSC_VER >= 1700)
+#define DFT_HAVE_AVX2
+#include <immintrin.h>
+#endif
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5) || (defined(_MSC_VER) && _MSC_VER >= 1910)
+#define DFT_HAVE_AVX512
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC compiles every kernel for its own instruction set; MSVC allows any
+// intrinsic without special flags
+#ifdef __GNUC__
+#define DFT_TARGET(set) __attribute__((target(set)))
+#else
+#define DFT_TARGET(set)
+#endif
+
+/*
+ * Asks the processor (and the OS, for the wide registers) which kernels
+ * can run.
+ */
+static int detect_instruction_set()
+{
+#if defined(DFT_X86) && defined(__GNUC__)
+   __builtin_cpu_init();
+#ifdef DFT_HAVE_AVX512
+   if(__builtin_cpu_supports("avx512f"))
+      return FFT_AVX512;
+#endif
+   if(__builtin_cpu_supports("avx2"))
+      return FFT_AVX2;
+   if(__builtin_cpu_supports("sse2"))
+      return FFT_SSE2;
+#elif defined(DFT_X86) && defined(_MSC_VER)
+   int info[4];
+   __cpuid(info, 0);
+   int leaves = info[0];
+   __cpuid(info, 1);
+   bool sse2 = (info[3] & (1 << 26)) != 0;
+#ifdef DFT_HAVE_AVX2
+   unsigned __int64 xcr0 = (info[2] & (1 << 27)) ? _xgetbv(0) : 0;
+   if(leaves >= 7) {
+      __cpuidex(info, 7, 0);
+#ifdef DFT_HAVE_AVX512
+      if((info[1] & (1 << 16)) && (xcr0 & 0xe6) == 0xe6)
+         return FFT_AVX512;
+#endif
+      if((info[1] & (1 << 5)) && (xcr0 & 0x6) == 0x6)
+         return FFT_AVX2;
+   }
+#endif
+   if(sse2)
+      return FFT_SSE2;
+#endif
+   return FFT_SCALAR;
+}
+
+static int detected_set = -1;
+static int limit_set = -1;
+
+int fft_instruction_set()
+{
+   if(detected_set < 0)
+      detected_set = detect_instruction_set();
+   if(limit_set >= 0 && limit_set < detected_set)
+      return limit_set;
+   return detected_set;
+}
+
+void set_fft_instruction_set(int set)
+{
+   limit_set = set;
+}
+
+/*
+ * Radix-2 pass: butterflies between elements m apart in every block of 2m.
+ * The twiddles of the pass are tw[m] ... tw[2m - 1].
+ */
+static void radix2_scalar(double *re, double *im, int size, int m,
+                          const double *tw_re, const double *tw_im)
+{
+   for(int b = 0; b < size; b += 2*m) {
+      for(int i = 0; i < m; i++) {
+         int p = b + i, q = p + m;
+         double wr = tw_re[m+i], wi = tw_im[m+i];
+         double tr = wr*re[q] - wi*im[q], ti = wr*im[q] + wi*re[q];
+         re[q] = re[p] - tr;
+         im[q] = im[p] - ti;
+         re[p] += tr;
+         im[p] += ti;
+      }
+   }
+}
+
+/*
+ * Radix-4 pass: two radix-2 passes (m and 2m) fused over blocks of 4m, so
+ * every element is loaded and stored once instead of twice.  The second
+ * twiddle of the upper half is multiplied by exp(i*pi/2) = i.
+ */
+static void radix4_scalar(double *re, double *im, int size, int m,
+                          const double *tw_re, const double *tw_im)
+{
+   for(int b = 0; b < size; b += 4*m) {
+      for(int i = 0; i < m; i++) {
+         int p0 = b + i, p1 = p0 + m, p2 = p1 + m, p3 = p2 + m;
+         double w1r = tw_re[m+i], w1i = tw_im[m+i];
+         double w2r = tw_re[2*m+i], w2i = tw_im[2*m+i];
+
+         double tr = w1r*re[p1] - w1i*im[p1], ti = w1r*im[p1] + w1i*re[p1];
+         double a0r = re[p0] + tr, a0i = im[p0] + ti;
+         double a1r = re[p0] - tr, a1i = im[p0] - ti;
+         tr = w1r*re[p3] - w1i*im[p3];
+         ti = w1r*im[p3] + w1i*re[p3];
+         double a2r = re[p2] + tr, a2i = im[p2] + ti;
+         double a3r = re[p2] - tr, a3i = im[p2] - ti;
+
+         tr = w2r*a2r - w2i*a2i;
+         ti = w2r*a2i + w2i*a2r;
+         re[p0] = a0r + tr;
+         im[p0] = a0i + ti;
+         re[p2] = a0r - tr;
+         im[p2] = a0i - ti;
+         tr = -(w2r*a3i + w2i*a3r);
+         ti = w2r*a3r - w2i*a3i;
+         re[p1] = a1r + tr;
+         im[p1] = a1i + ti;
+         re[p3] = a1r - tr;
+         im[p3] = a1i - ti;
+      }
+   }
+}
+
+#ifdef DFT_X86
+
+DFT_TARGET("sse2")
+static void radix2_sse2(double *re, double *im, int size, int m,
+                        const double *tw_re, const double *tw_im)
+{
+   for(int b = 0; b < size; b += 2*m) {
+      for(int i = 0; i < m; i += 2) {
+         double *pr = re + b + i, *pi = im + b + i;
+         __m128d wr = _mm_loadu_pd(tw_re + m + i);
+         __m128d wi = _mm_loadu_pd(tw_im + m + i);
+         __m128d xr = _mm_loadu_pd(pr), xi = _mm_loadu_pd(pi);
+         __m128d yr = _mm_loadu_pd(pr + m), yi = _mm_loadu_pd(pi + m);
+         __m128d tr = _mm_sub_pd(_mm_mul_pd(wr, yr), _mm_mul_pd(wi, yi));
+         __m128d ti = _mm_add_pd(_mm_mul_pd(wr, yi), _mm_mul_pd(wi, yr));
+         _mm_storeu_pd(pr, _mm_add_pd(xr, tr));
+         _mm_storeu_pd(pi, _mm_add_pd(xi, ti));
+         _mm_storeu_pd(pr + m, _mm_sub_pd(xr, tr));
+         _mm_storeu_pd(pi + m, _mm_sub_pd(xi, ti));
+      }
+   }
+}
+
+DFT_TARGET("sse2")
+static void radix4_sse2(double *re, double *im, int size, int m,
+                        const double *tw_re, const double *tw_im)
+{
+   for(int b = 0; b < size; b += 4*m) {
+      for(int i = 0; i < m; i += 2) {
+         double *r = re + b + i, *s = im + b + i;
+         __m128d w1r = _mm_loadu_pd(tw_re + m + i);
+         __m128d w1i = _mm_loadu_pd(tw_im + m + i);
+         __m128d w2r = _mm_loadu_pd(tw_re + 2*m + i);
+         __m128d w2i = _mm_loadu_pd(tw_im + 2*m + i);
+         __m128d x0r = _mm_loadu_pd(r), x0i = _mm_loadu_pd(s);
+         __m128d x1r = _mm_loadu_pd(r + m), x1i = _mm_loadu_pd(s + m);
+         __m128d x2r = _mm_loadu_pd(r + 2*m), x2i = _mm_loadu_pd(s + 2*m);
+         __m128d x3r = _mm_loadu_pd(r + 3*m), x3i = _mm_loadu_pd(s + 3*m);
+
+         __m128d tr = _mm_sub_pd(_mm_mul_pd(w1r, x1r), _mm_mul_pd(w1i, x1i));
+         __m128d ti = _mm_add_pd(_mm_mul_pd(w1r, x1i), _mm_mul_pd(w1i, x1r));
+         __m128d a0r = _mm_add_pd(x0r, tr), a0i = _mm_add_pd(x0i, ti);
+         __m128d a1r = _mm_sub_pd(x0r, tr), a1i = _mm_sub_pd(x0i, ti);
+         tr = _mm_sub_pd(_mm_mul_pd(w1r, x3r), _mm_mul_pd(w1i, x3i));
+         ti = _mm_add_pd(_mm_mul_pd(w1r, x3i), _mm_mul_pd(w1i, x3r));
+         __m128d a2r = _mm_add_pd(x2r, tr), a2i = _mm_add_pd(x2i, ti);
+         __m128d a3r = _mm_sub_pd(x2r, tr), a3i = _mm_sub_pd(x2i, ti);
+
+         tr = _mm_sub_pd(_mm_mul_pd(w2r, a2r), _mm_mul_pd(w2i, a2i));
+         ti = _mm_add_pd(_mm_mul_pd(w2r, a2i), _mm_mul_pd(w2i, a2r));
+         _mm_storeu_pd(r, _mm_add_pd(a0r, tr));
+         _mm_storeu_pd(s, _mm_add_pd(a0i, ti));
+         _mm_storeu_pd(r + 2*m, _mm_sub_pd(a0r, tr));
+         _mm_storeu_pd(s + 2*m, _mm_sub_pd(a0i, ti));
+         tr = _mm_sub_pd(_mm_setzero_pd(),
+                         _mm_add_pd(_mm_mul_pd(w2r, a3i), _mm_mul_pd(w2i, a3r)));
+         ti = _mm_sub_pd(_mm_mul_pd(w2r, a3r), _mm_mul_pd(w2i, a3i));
+         _mm_storeu_pd(r + m, _mm_add_pd(a1r, tr));
+         _mm_storeu_pd(s + m, _mm_add_pd(a1i, ti));
+         _mm_storeu_pd(r + 3*m, _mm_sub_pd(a1r, tr));
+         _mm_storeu_pd(s + 3*m, _mm_sub_pd(a1i, ti));
+      }
+   }
+}
+
+#endif
+
+#ifdef DFT_HAVE_AVX2
+
+DFT_TARGET("avx2")
+static void radix2_avx2(double *re, double *im, int size, int m,
+                        const double *tw_re, const double *tw_im)
+{
+   for(int b = 0; b < size; b += 2*m) {
+      for(int i = 0; i < m; i += 4) {
+         double *pr = re + b + i, *pi = im + b + i;
+         __m256d wr = _mm256_loadu_pd(tw_re + m + i);
+         __m256d wi = _mm256_loadu_pd(tw_im + m + i);
+         __m256d xr = _mm256_loadu_pd(pr), xi = _mm256_loadu_pd(pi);
+         __m256d yr = _mm256_loadu_pd(pr + m), yi = _mm256_loadu_pd(pi + m);
+         __m256d tr = _mm256_sub_pd(_mm256_mul_pd(wr, yr), _mm256_mul_pd(wi, yi));
+         __m256d ti = _mm256_add_pd(_mm256_mul_pd(wr, yi), _mm256_mul_pd(wi, yr));
+         _mm256_storeu_pd(pr, _mm256_add_pd(xr, tr));
+         _mm256_storeu_pd(pi, _mm256_add_pd(xi, ti));
+         _mm256_storeu_pd(pr + m, _mm256_sub_pd(xr, tr));
+         _mm256_storeu_pd(pi + m, _mm256_sub_pd(xi, ti));
+      }
+   }
+}
+
+DFT_TARGET("avx2")
+static void radix4_avx2(double *re, double *im, int size, int m,
+                        const double *tw_re, const double *tw_im)
+{
+   for(int b = 0; b < size; b += 4*m) {
+      for(int i = 0; i < m; i += 4) {
+         double *r = re + b + i, *s = im + b + i;
+         __m256d w1r = _mm256_loadu_pd(tw_re + m + i);
+         __m256d w1i = _mm256_loadu_pd(tw_im + m + i);
+         __m256d w2r = _mm256_loadu_pd(tw_re + 2*m + i);
+         __m256d w2i = _mm256_loadu_pd(tw_im + 2*m + i);
+         __m256d x0r = _mm256_loadu_pd(r), x0i = _mm256_loadu_pd(s);
+         __m256d x1r = _mm256_loadu_pd(r + m), x1i = _mm256_loadu_pd(s + m);
+         __m256d x2r = _mm256_loadu_pd(r + 2*m), x2i = _mm256_loadu_pd(s + 2*m);
+         __m256d x3r = _mm256_loadu_pd(r + 3*m), x3i = _mm256_loadu_pd(s + 3*m);
+
+         __m256d tr = _mm256_sub_pd(_mm256_mul_pd(w1r, x1r), _mm256_mul_pd(w1i, x1i));
+         __m256d ti = _mm256_add_pd(_mm256_mul_pd(w1r, x1i), _mm256_mul_pd(w1i, x1r));
+         __m256d a0r = _mm256_add_pd(x0r, tr), a0i = _mm256_add_pd(x0i, ti);
+         __m256d a1r = _mm256_sub_pd(x0r, tr), a1i = _mm256_sub_pd(x0i, ti);
+         tr = _mm256_sub_pd(_mm256_mul_pd(w1r, x3r), _mm256_mul_pd(w1i, x3i));
+         ti = _mm256_add_pd(_mm256_mul_pd(w1r, x3i), _mm256_mul_pd(w1i, x3r));
+         __m256d a2r = _mm256_add_pd(x2r, tr), a2i = _mm256_add_pd(x2i, ti);
+         __m256d a3r = _mm256_sub_pd(x2r, tr), a3i = _mm256_sub_pd(x2i, ti);
+
+         tr = _mm256_sub_pd(_mm256_mul_pd(w2r, a2r), _mm256_mul_pd(w2i, a2i));
+         ti = _mm256_add_pd(_mm256_mul_pd(w2r, a2i), _mm256_mul_pd(w2i, a2r));
+         _mm256_storeu_pd(r, _mm256_add_pd(a0r, tr));
+         _mm256_storeu_pd(s, _mm256_add_pd(a0i, ti));
+         _mm256_storeu_pd(r + 2*m, _mm256_sub_pd(a0r, tr));
+         _mm256_storeu_pd(s + 2*m, _mm256_sub_pd(a0i, ti));
+         tr = _mm256_sub_pd(_mm256_setzero_pd(),
+                            _mm256_add_pd(_mm256_mul_pd(w2r, a3i), _mm256_mul_pd(w2i, a3r)));
+         ti = _mm256_sub_pd(_mm256_mul_pd(w2r, a3r), _mm256_mul_pd(w2i, a3i));
+         _mm256_storeu_pd(r + m, _mm256_add_pd(a1r, tr));
+         _mm256_storeu_pd(s + m, _mm256_add_pd(a1i, ti));
+         _mm256_storeu_pd(r + 3*m, _mm256_sub_pd(a1r, tr));
+         _mm256_storeu_pd(s + 3*m, _mm256_sub_pd(a1i, ti));
+      }
+   }
+}
+
+#endif
+
+#ifdef DFT_HAVE_AVX512
+
+DFT_TARGET("avx512f")
+static void radix2_avx512(double *re, double *im, int size, int m,
+                          const double *tw_re, const double *tw_im)
+{
+   for(int b = 0; b < size; b += 2*m) {
+      for(int i = 0; i < m; i += 8) {
+         double *pr = re + b + i, *pi = im + b + i;
+         __m512d wr = _mm512_loadu_pd(tw_re + m + i);
+         __m512d wi = _mm512_loadu_pd(tw_im + m + i);
+         __m512d xr = _mm512_loadu_pd(pr), xi = _mm512_loadu_pd(pi);
+         __m512d yr = _mm512_loadu_pd(pr + m), yi = _mm512_loadu_pd(pi + m);
+         __m512d tr = _mm512_sub_pd(_mm512_mul_pd(wr, yr), _mm512_mul_pd(wi, yi));
+         __m512d ti = _mm512_add_pd(_mm512_mul_pd(wr, yi), _mm512_mul_pd(wi, yr));
+         _mm512_storeu_pd(pr, _mm512_add_pd(xr, tr));
+         _mm512_storeu_pd(pi, _mm512_add_pd(xi, ti));
+         _mm512_storeu_pd(pr + m, _mm512_sub_pd(xr, tr));
+         _mm512_storeu_pd(pi + m, _mm512_sub_pd(xi, ti));
+      }
+   }
+}
+
+DFT_TARGET("avx512f")
+static void radix4_avx512(double *re, double *im, int size, int m,
+                          const double *tw_re, const double *tw_im)
+{
+   for(int b = 0; b < size; b += 4*m) {
+      for(int i = 0; i < m; i += 8) {
+         double *r = re + b + i, *s = im + b + i;
+         __m512d w1r = _mm512_loadu_pd(tw_re + m + i);
+         __m512d w1i = _mm512_loadu_pd(tw_im + m + i);
+         __m512d w2r = _mm512_loadu_pd(tw_re + 2*m + i);
+         __m512d w2i = _mm512_loadu_pd(tw_im + 2*m + i);
+         __m512d x0r = _mm512_loadu_pd(r), x0i = _mm512_loadu_pd(s);
+         __m512d x1r = _mm512_loadu_pd(r + m), x1i = _mm512_loadu_pd(s + m);
+         __m512d x2r = _mm512_loadu_pd(r + 2*m), x2i = _mm512_loadu_pd(s + 2*m);
+         __m512d x3r = _mm512_loadu_pd(r + 3*m), x3i = _mm512_loadu_pd(s + 3*m);
+
+         __m512d tr = _mm512_sub_pd(_mm512_mul_pd(w1r, x1r), _mm512_mul_pd(w1i, x1i));
+         __m512d ti = _mm512_add_pd(_mm512_mul_pd(w1r, x1i), _mm512_mul_pd(w1i, x1r));
+         __m512d a0r = _mm512_add_pd(x0r, tr), a0i = _mm512_add_pd(x0i, ti);
+         __m512d a1r = _mm512_sub_pd(x0r, tr), a1i = _mm512_sub_pd(x0i, ti);
+         tr = _mm512_sub_pd(_mm512_mul_pd(w1r, x3r), _mm512_mul_pd(w1i, x3i));
+         ti = _mm512_add_pd(_mm512_mul_pd(w1r, x3i), _mm512_mul_pd(w1i, x3r));
+         __m512d a2r = _mm512_add_pd(x2r, tr), a2i = _mm512_add_pd(x2i, ti);
+         __m512d a3r = _mm512_sub_pd(x2r, tr), a3i = _mm512_sub_pd(x2i, ti);
+
+         tr = _mm512_sub_pd(_mm512_mul_pd(w2r, a2r), _mm512_mul_pd(w2i, a2i));
+         ti = _mm512_add_pd(_mm512_mul_pd(w2r, a2i), _mm512_mul_pd(w2i, a2r));
+         _mm512_storeu_pd(r, _mm512_add_pd(a0r, tr));
+         _mm512_storeu_pd(s, _mm512_add_pd(a0i, ti));
+         _mm512_storeu_pd(r + 2*m, _mm512_sub_pd(a0r, tr));
+         _mm512_storeu_pd(s + 2*m, _mm512_sub_pd(a0i, ti));
+         tr = _mm512_sub_pd(_mm512_setzero_pd(),
+                            _mm512_add_pd(_mm512_mul_pd(w2r, a3i), _mm512_mul_pd(w2i, a3r)));
+         ti = _mm512_sub_pd(_mm512_mul_pd(w2r, a3r), _mm512_mul_pd(w2i, a3i));
+         _mm512_storeu_pd(r + m, _mm512_add_pd(a1r, tr));
+         _mm512_storeu_pd(s + m, _mm512_add_pd(a1i, ti));
+         _mm512_storeu_pd(r + 3*m, _mm512_sub_pd(a1r, tr));
+         _mm512_storeu_pd(s + 3*m, _mm512_sub_pd(a1i, ti));
+      }
+   }
+}
+
+#endif
+
+/*
+ * Runs a radix-2 (``radix'' = 2) or radix-4 pass with the widest kernel
+ * that fits: a vector kernel needs at least one full register per block.
+ */
+static void pass(double *re, double *im, const FFT_PLAN *plan, int m,
+                 int radix, int set)
+{
+   int size = plan->size;
+   const double *tw_re = plan->twiddle_re, *tw_im = plan->twiddle_im;
+
+#ifdef DFT_HAVE_AVX512
+   if(set >= FFT_AVX512 && m >= 8) {
+      if(radix == 4)
+         radix4_avx512(re, im, size, m, tw_re, tw_im);
+      else
+         radix2_avx512(re, im, size, m, tw_re, tw_im);
+      return;
+   }
+#endif
+#ifdef DFT_HAVE_AVX2
+   if(set >= FFT_AVX2 && m >= 4) {
+      if(radix == 4)
+         radix4_avx2(re, im, size, m, tw_re, tw_im);
+      else
+         radix2_avx2(re, im, size, m, tw_re, tw_im);
+      return;
+   }
+#endif
+#ifdef DFT_X86
+   if(set >= FFT_SSE2 && m >= 2) {
+      if(radix == 4)
+         radix4_sse2(re, im, size, m, tw_re, tw_im);
+      else
+         radix2_sse2(re, im, size, m, tw_re, tw_im);
+      return;
+   }
+#endif
+   if(radix == 4)
+      radix4_scalar(re, im, size, m, tw_re, tw_im);
+   else
+      radix2_scalar(re, im, size, m, tw_re, tw_im);
+}
+
+/*
+ * Does the Discrete Fourier Transform.  Radix-4 passes are used while at
+ * least two radix-2 steps remain; an odd bit length ends with radix-2.
+ */
+void split_fourier_transform(double *re, double *im, const FFT_PLAN *plan)
+{
+   int size = plan->size;
+   int set = fft_instruction_set();
+
+   for(int i = 0; i < size; i++) {
+      int j = plan->reversed[i];
+      if(i < j) {
+         swap(re[i], re[j]);
+         swap(im[i], im[j]);
+      }
+   }
+
+   int m = 1;
+   for(; 4*m <= size; m *= 4)
+      pass(re, im, plan, m, 4, set);
+   if(2*m <= size)
+      pass(re, im, plan, m, 2, set);
+}
+
+/*
+ * The inverse DFT.  Swapping the real and imaginary parts conjugates the
+ * direction of the transform, so no conjugation passes are needed.
+ */
+void inverse_split_fourier_transform(double *re, double *im,
+                                     const FFT_PLAN *plan)
+{
+   int size = plan->size;
+   split_fourier_transform(im, re, plan);
+   double scale = 1.0/size;
+   for(int i = 0; i < size; i++) {
+      re[i] *= scale;
+      im[i] *= scale;
+   }
+}
@@ -0,0 +1,37 @@
+/*
+ * Fast Fourier Transform on split-complex arrays (SIMD kernels)
+ *
+ * The real and imaginary parts are kept in two separate arrays, so every
+ * vector register holds several numbers of the same kind and the butterflies
+ * need no shuffles.  The kernels are written for SSE2, AVX2 and AVX-512; the
+ * instruction set is chosen at run time.
+ *
+ * The result agrees with fourier_transform() on the same plan to within
+ * 4 * log2(size) * DBL_EPSILON * max|X| for every coefficient X.
+ */
+
+#ifndef __DFT_SPLIT_H__
+#define __DFT_SPLIT_H__
+
+#include "dft.h"
+
+#define FFT_SCALAR 0
+#define FFT_SSE2 1
+#define FFT_AVX2 2
+#define FFT_AVX512 3
+
+// Returns the instruction set used by the split-complex transforms
+int fft_instruction_set();
+
+// Limits the instruction set (e.g. FFT_SCALAR to compare kernels).  The best
+// set supported by the processor is still never exceeded.  -1 resets it
+void set_fft_instruction_set(int set);
+
+// Discrete fourier transform of re[k] + i*im[k]. The plan decides the size
+void split_fourier_transform(double *re, double *im, const FFT_PLAN *plan);
+
+// Inverse fourier transform on split-complex arrays
+void inverse_split_fourier_transform(double *re, double *im,
+                                     const FFT_PLAN *plan);
+
+#endif
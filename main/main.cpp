@@ -6,9 +6,24 @@
 
 #include "dft.h"
 #include "dft.cpp"
+#include "dft_split.cpp"
+#include "threads.cpp"
+#include "trace.cpp"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
 #include <math.h>
+#include <limits.h>
 #include <time.h>
+#ifndef _WIN32
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#endif
 #include <string>
 #include <FreeImage.h>
 #pragma comment(lib,"FreeImage.lib")
@@ -22,6 +37,7 @@
 #define JPEG 3
 #define PNG 4
 #define TIFF 5
+#define RAW 6
 #define BYTE unsigned char
 #define FOUR_SIDES 1
 #define EIGHT_SIDES 2
@@ -30,34 +46,260 @@
 #define PSF_LINEAR 2
 #define PSF_RANDOM_BLUR 3
 #define PSF_RANDOM_PATH 4
+#define CONV_DIRECT 0
+#define CONV_FFT 1
+#define CONV_SEPARABLE 2
+#define CONV_AUTO 3
+#define CONV_PROFILE "conv_profile.txt"
+#define SEPARABLE_TOLERANCE 1e-3
+#define CONV_TUNE_PIXELS 65536
+#define CONV_TILE 256
+#define CONV_SCRATCH 1
+#define LAPLACE_SCRATCH 2
+#define BANDED_LU_MEMORY 1073741824.0
+#define REG_IDENTITY 0
+#define REG_LAPLACE 1
+#define TILE_SIZE 512
+#define TILE_HALO_MAX 256
+#define GRID_CONV 0
+#define GRID_LUCY 1
+#define BLIND_WEIGHT 0.002
+#define BLIND_KERNEL_WEIGHT 0.01
+#define WORKSPACE_ALIGN 64
+#define WORKSPACE_PLANS 8
+#define RAW_MAGIC "DCNV"
+#define RAW_VERSION 1
+#define STEP_GRAYSCALE 0
+#define STEP_INVERSE 1
+#define STEP_LAPLACE 2
+#define STEP_NORMALIZE 3
+#define STEP_SUPERRESOLUTION 4
+#define STEP_CONV 5
+#define STEP_DECONV 6
+#define STEP_DECONVINVERSE 7
+#define STEP_DECONVWIENER 8
+#define STEP_DECONVLUCY 9
+#define STEP_DECONVLUCYACCEL 10
+#define STEP_DECONVLUCYMULTI 11
+#define STEP_COUNT 12
+#define BATCH_STEPS "deconvlucy:10,normalize"
+#define BATCH_SUFFIX "_res"
+#define BATCH_SNAPSHOTS 16
+#define LUCY_CHECKPOINT 10
+#define STOP_ITERATIONS 0
+#define STOP_TOLERANCE 1
+#define STOP_STAGNATION 2
+#define STOP_TIME 3
+#define STOP_CALLBACK 4
+#define STAGNATION_GAIN 1e-3
 
-struct IMAGE {
-	double *map[3]; //   
+/*
+ *     T.     
+ *    double,  IMAGE_T<float>   
+ *    
+ */
+template <class T>
+struct IMAGE_T {
+	T *map[3]; //   
 	int channels; //   . 1 -  , 3 - RGB 
 	int width; //    
 	int height; //    
 };
 
-struct FOURIER_IMAGE {
-	comp *map[3]; //   
+typedef IMAGE_T<double> IMAGE;
+typedef IMAGE_T<float> FLOAT_IMAGE;
+
+template <class T>
+struct FOURIER_IMAGE_T {
+	complex<T> *map[3]; //   
 	int channels; //   . 1 -  , 3 - RGB 
 	int width; //    
 	int height; //    
 };
 
-struct COMPLEX_ARRAYS {
-	int size;
-	comp *arrays[3];
+typedef FOURIER_IMAGE_T<double> FOURIER_IMAGE;
+
+struct FFT_KERNEL {
+	comp *spectrum; //      
+	comp *buf; //      
+	double *area; //     
+	int *index_x, *index_y; //        
+	int width; //    
+	int height; //    
+	int fft_width; //    ( )
+	int fft_height; //    ( )
+	int spectrum_size; //     
+	double div; //  
+};
+
+struct CONV_PLAN {
+	int method; //  : CONV_DIRECT, CONV_FFT  CONV_SEPARABLE
+	int requested; //  ,   CONV_AUTO
+	double *h; //     ,  0
+	int w1, h1, w2, h2; //    
+	int a, b; //    
+	double div; //  
+	FFT_KERNEL *kernel; //    CONV_FFT
+	int rank; //      CONV_SEPARABLE
+	double *row, *column; //    , 0    
+	double *buf; //       
+};
+
+struct CONV_CHOICE {
+	int w1, h1, w2, h2; //    
+	int rank; //  , 0    
+	int threads; //  
+	int method; //    
+};
+
+struct WORKSPACE_PLAN {
+	IMAGE *psf; //  ,    
+	IMAGE *psf_inv; //  
+	int width, height; //  
+	int method; //  
+	CONV_PLAN *plan, *plan_inv; //       
+};
+
+struct WORKSPACE {
+	void **blocks; //   
+	void **origins; //   ,    malloc()
+	size_t *sizes; //    
+	bool *used; //   
+	int count; //  
+	int capacity; //   
+	WORKSPACE_PLAN plans[WORKSPACE_PLANS]; //   
+	int plan_count; //   
+	int plan_next; //    
 };
 
 /*
- *   
+ *    .      
+ * ,    ,   - 
+ *  ,    
  */
-IMAGE *createImage(int width, int height, int channels) {
-	int i, k; //  
+struct ITERATION_METRICS {
+	int iteration; //  ,   1
+	double residual; //   ||g - h*f||/||g||
+	double change; //    ||f' - f||/||f||
+	double divergence; // I- sum(g*ln(g/(h*f)) - g + h*f)  
+	double time; //    
+};
+
+//    , false  
+typedef bool (*ITERATION_CALLBACK)(const ITERATION_METRICS *metrics, void *context);
+
+struct STOP_RULES {
+	double tolerance; // ,  change  tolerance, 0 -  
+	int stagnation; // ,  residual      STAGNATION_GAIN, 0 -  
+	double budget; //    , 0 -  
+	ITERATION_CALLBACK callback; //    ,   0
+	void *context; //   callback
+};
+
+struct CONVERGENCE {
+	STOP_RULES rules; //  
+	ITERATION_METRICS metrics; //   
+	double start; //   
+	double best; //  , -1   
+	int best_iteration; // ,        
+	int reason; //   ,   STOP_*
+};
+
+struct BATCH_STEP {
+	int operation; //   STEP_*
+	double parameter; //   : ,   ..
+	bool given; //    
+	int snapshots[BATCH_SNAPSHOTS]; //  ,  deconvlucy:5/20/100
+	int snapshot_count; //  , 0 -  
+};
+
+struct BATCH {
+	BATCH_STEP *steps; //    
+	int step_count; //  
+	IMAGE *psf; // ,    
+	int method; //  
+	char **inputs; //  
+	int input_count; //   
+	int input_capacity; //    
+	const char *output_dir; //   , 0 -    
+	const char *suffix; //    
+	int bits; //     
+	bool checkpoint; //     -
+	STOP_RULES rules; //    
+	int failed; //   
+	MUTEX mutex; //  failed
+};
+
+struct RAW_HEADER {
+	char magic[4]; // RAW_MAGIC
+	int version; // RAW_VERSION
+	int width, height, channels; //    
+	int sample; //   : 4 (float)  8 (double)
+	int tag; //  ,     
+	unsigned int fingerprint; //  ,     ,  0
+	char reserved[32]; //    64 ,    
+};
+
+struct RAW_FILE {
+	RAW_HEADER *header; //   
+	size_t size; //    
+	bool writable; //    
+	IMAGE image; //    double,  sample = 8
+	FLOAT_IMAGE float_image; //    float,  sample = 4
+#ifdef _WIN32
+	HANDLE file, mapping; //    
+#else
+	int fd; //  
+#endif
+};
+
+struct TILE_STORE {
+	int width; //    
+	int height; //    
+	int channels; //   
+	void *data; //  
+	//   tile      (x, y)   tile.
+	//        
+	void (*read)(TILE_STORE *store, int x, int y, OUT IMAGE *tile);
+	//    (x, y)  (ox, oy, w, h)  tile
+	void (*write)(TILE_STORE *store, int x, int y, IN IMAGE *tile, int ox, int oy, int w, int h);
+	//   
+	void (*close)(TILE_STORE *store);
+};
+
+struct PSF_GRID {
+	int cols, rows; //      
+	IMAGE **psf; //   
+	IMAGE **psf_inv; //   
+	CONV_PLAN **plan, **plan_inv; //    
+};
+
+struct BANDED_LU {
+	double *u; //  U:  i   i - kl ... i + kl + ku
+	double *l; //  L: kl     
+	int *pivot; //  ,   i   i
+	int size; //   ( )
+	int kl, ku; //      
+	int row; //    U: 2*kl + ku + 1
+	int width; //    
+	int height; //    
+	bool transposed; //    ,    
+};
+
+struct ELIMINATE_TASK {
+	BANDED_LU *lu; // 
+	int j; //  
+	int last; //     
+};
+
+/*
+ *   .  zero = false,   
+ */
+template <class T>
+IMAGE_T<T> *createTypedImage(int width, int height, int channels, bool zero = true) {
+	int k; //  
 	int size; //   
-	double *map; //  
-	IMAGE *image; //  
+	IMAGE_T<T> *image; //  
 
 	if (width < 0 || height < 0) {
 		printf("createImage: image cannot be of a size (%d, %d)\n", width, height);
@@ -66,27 +308,32 @@ IMAGE *createImage(int width, int height, int channels) {
 	if (channels != 1 && channels != 3) {
 		printf("createImage: image cannot contain %d color channels\n", channels);
 	}
-	image = new IMAGE();
+	image = new IMAGE_T<T>();
 	image->width = width;
 	image->height = height;
 	image->channels = channels;
 	
 	size = width*height;
 	for (k = 0; k < channels; k++) {
-		image->map[k] = new double[size];
-		map = image->map[k];
-		for (i = 0; i < size; i++) {
-			map[i] = 0.0;
+		image->map[k] = new T[size];
+		if (zero) {
+			memset(image->map[k], 0, size*sizeof(T));
 		}
 	}
+	TRACE_ALLOC((double)channels*size*sizeof(T));
 	return image;
 }
 
+IMAGE *createImage(int width, int height, int channels) {
+	return createTypedImage<double>(width, height, channels);
+}
+
 
 /*
  *     
  */
-IMAGE *copyImage(IMAGE *image) {
+template <class T>
+IMAGE_T<T> *copyImage(IMAGE_T<T> *image) {
 	int i, j; //  
 	int w, h; //    
 	int size; //    
@@ -101,7 +348,7 @@ IMAGE *copyImage(IMAGE *image) {
 	size=w*h;
 	channels = image->channels;
 
-	IMAGE *new_image = createImage(w, h, channels);
+	IMAGE_T<T> *new_image = createTypedImage<T>(w, h, channels);
 	for (j = 0; j < channels; j++) {
 		for (i = 0; i < size; i++) {
 			new_image->map[j][i] = image->map[j][i];
@@ -110,10 +357,34 @@ IMAGE *copyImage(IMAGE *image) {
 	return new_image;
 }
 
+/*
+ *       
+ */
+template <class T, class S>
+IMAGE_T<T> *convertImage(IMAGE_T<S> *image) {
+	int i, j; //  
+	int size; //    
+	IMAGE_T<T> *new_image; //  
+
+	if (image == 0) {
+		printf("convertImage: cannot convert image, because it's 0\n");
+		return 0;
+	}
+	size = image->width*image->height;
+	new_image = createTypedImage<T>(image->width, image->height, image->channels);
+	for (j = 0; j < image->channels; j++) {
+		for (i = 0; i < size; i++) {
+			new_image->map[j][i] = (T)image->map[j][i];
+		}
+	}
+	return new_image;
+}
+
 /*
  *  
  */
-void deleteImage(IMAGE *image) {
+template <class T>
+void deleteImage(IMAGE_T<T> *image) {
 	int i; //  
 	int channels; //   
 
@@ -125,6 +396,7 @@ void deleteImage(IMAGE *image) {
 	for (i = 0; i < channels; i++) {
 		delete [] image->map[i];
 	}
+	TRACE_FREE((double)channels*image->width*image->height*sizeof(T));
 	delete image;
 }
 
@@ -159,6 +431,10 @@ IMAGE *generatePSF(int width, int height, int type = PSF_RANDOM) {
 	IMAGE *psf; //  
 	double lum; //     
 	double *map; //    
+	double x, y, angle; //     
+	double sx, sy; //      
+	double *path; //  
+	int steps; //   
 
 	if (width%2 != 1 || height%2 != 1) {
 		printf("conv: PSF is of non-standard size (%d, %d)\n", width, height);
@@ -192,8 +468,57 @@ IMAGE *generatePSF(int width, int height, int type = PSF_RANDOM) {
 			}
 			break;
 		case PSF_RANDOM_PATH:
+			//        ,
+			//       
+			steps = 2*(a + b) + 1;
+			path = new double[2*steps];
+			x = 0;
+			y = 0;
+			sx = 0;
+			sy = 0;
+			angle = 2*PI*rand()/RAND_MAX;
+			for (i = 0; i < steps; i++) {
+				path[2*i] = x;
+				path[2*i + 1] = y;
+				sx += x/steps;
+				sy += y/steps;
+				angle += (double)(rand()%31 - 15)*PI/180;
+				x += 0.5*cos(angle);
+				y += 0.5*sin(angle);
+			}
+			for (i = 0; i < steps; i++) {
+				x = floor(a + path[2*i] - sx + 0.5);
+				y = floor(b + path[2*i + 1] - sy + 0.5);
+				if (x >= 0 && x < width && y >= 0 && y < height) {
+					map[(int)y*width + (int)x] += 1.0;
+				}
+			}
+			delete [] path;
+			break;
+
 		case PSF_RANDOM_BLUR:
-		break;
+			//        
+			sx = (a + 1)*(0.2 + 0.3*rand()/RAND_MAX);
+			sy = (b + 1)*(0.2 + 0.3*rand()/RAND_MAX);
+			angle = PI*rand()/RAND_MAX;
+			for (i = 0; i < width; i++) {
+				for (j = 0; j < height; j++) {
+					x = (i - a)*cos(angle) + (j - b)*sin(angle);
+					y = (j - b)*cos(angle) - (i - a)*sin(angle);
+					map[j*width + i] = exp(-x*x/(2*sx*sx) - y*y/(2*sy*sy));
+				}
+			}
+			break;
+	}
+	//     1
+	lum = 0;
+	for (i = 0; i < size; i++) {
+		if (map[i] > lum) lum = map[i];
+	}
+	if ((type == PSF_RANDOM_PATH || type == PSF_RANDOM_BLUR) && lum > 0) {
+		for (i = 0; i < size; i++) {
+			map[i] /= lum;
+		}
 	}
 	return psf;
 }
@@ -224,805 +549,4557 @@ double getPSFDivisor(IMAGE *psf) {
 }
 
 /*
- *  ,  FreeImage
+ *  FreeImage   
  */
-IMAGE *loadImage(const char *name, int type) {
-	IMAGE *result;
-	FIBITMAP *bitmap;
-	FREE_IMAGE_FORMAT fif;
-
+FREE_IMAGE_FORMAT _image_format(int type) {
 	switch(type) {
-		case 1: 
-			fif = FIF_BMP; 
-			break;
-		case 2: 
-			fif = FIF_GIF; 
-			break;
-		case 3: 
-			fif = FIF_JPEG; 
-			break;
-		case 4: 
-			fif = FIF_PNG; 
-			break;
-		case 5: 
-			fif = FIF_TIFF; 
-			break;
-		default:
-			fif = FIF_UNKNOWN;
-	}
-	if (fif == FIF_UNKNOWN) {
-		printf("loadImage: unknown file format: %d\n", type);
-	} else {
-		bitmap = FreeImage_Load(fif, name, 0); //    
-		if (bitmap) {
-			int width, height; //       
-			int x, y; //  
-			bool success; //     
-			RGBQUAD color; //  
-
-			printf("loadImage: image was loaded! Year!\n");
-			
-			width = FreeImage_GetWidth(bitmap);
-			height = FreeImage_GetHeight(bitmap);		
-			result = createImage(width, height, 3);
-
-			success = true;
-			for (x = 0; x < width; x++) {
-				for (y = 0; y < height; y++) {
-					success = FreeImage_GetPixelColor(bitmap, x, y, &color);
-					result->map[0][width*y + x] = (double)color.rgbRed/255;
-					result->map[1][width*y + x] = (double)color.rgbGreen/255;
-					result->map[2][width*y + x] = (double)color.rgbBlue/255;
-					if (!success) break;
-				}
-				if (!success) break;
-			}
-			if (success) {
-				printf("loadImage: color maps were formed!\n");
-			} else {
-				printf("loadImage: couldn\'t get pixel (%d, %d)\n", x, y);
-			}
-			FreeImage_Unload(bitmap);
-		} else {
-			printf("loadImage: image was not loaded\n");
-			return 0;
-		}
+		case BMP: return FIF_BMP;
+		case GIF: return FIF_GIF;
+		case JPEG: return FIF_JPEG;
+		case PNG: return FIF_PNG;
+		case TIFF: return FIF_TIFF;
+		default: return FIF_UNKNOWN;
 	}
-	return result;
 }
 
 /*
- *  ,  FreeImage
+ *    .  size > 0,     
  */
-void saveImage(IMAGE *image, const char *name, int type) {
-	FIBITMAP *bitmap;
-	FREE_IMAGE_FORMAT fif;
-	
-	if (image == 0) {
-		printf("saveImage: cannot save image, because it's 0\n");
-		return;
+RAW_FILE *_map_raw_file(const char *name, size_t size, bool writable) {
+	RAW_FILE *file; //  
+
+	file = new RAW_FILE();
+	file->writable = writable;
+#ifdef _WIN32
+	LARGE_INTEGER length; //   
+
+	file->file = CreateFileA(name, writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, 0,
+		(size > 0) ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (file->file == INVALID_HANDLE_VALUE) {
+		delete file;
+		return 0;
 	}
-	switch(type) {
-		case 1: 
-			fif = FIF_BMP; 
-			break;
-		case 2: 
-			fif = FIF_GIF; 
-			break;
-		case 3: 
-			fif = FIF_JPEG; 
-			break;
-		case 4: 
-			fif = FIF_PNG; 
-			break;
-		case 5: 
-			fif = FIF_TIFF; 
-			break;
-		default:
-			fif = FIF_UNKNOWN;
+	if (size == 0) {
+		GetFileSizeEx(file->file, &length);
+		size = (size_t)length.QuadPart;
 	}
-	if (fif == FIF_UNKNOWN) {
-		printf("saveImage: unknown file format: %d\n", type);
-		return;
+	file->size = size;
+	file->mapping = (size == 0) ? 0 : CreateFileMappingA(file->file, 0, writable ? PAGE_READWRITE : PAGE_READONLY,
+		(DWORD)((unsigned __int64)size >> 32), (DWORD)size, 0);
+	file->header = (file->mapping == 0) ? 0 : (RAW_HEADER *)MapViewOfFile(file->mapping,
+		writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+	if (file->header == 0) {
+		if (file->mapping != 0) CloseHandle(file->mapping);
+		CloseHandle(file->file);
+		delete file;
+		return 0;
 	}
-	
-	bitmap = FreeImage_Allocate(image->width, image->height, 24); //    
-	if (bitmap) {
-		int width, height; //       
-		int x, y; //  
-		bool success; //     
-		double *red_map, *green_map, *blue_map;
-		RGBQUAD color; //  
-		
-		printf("saveImage: image was created!\n");
-
-		if (image->channels == 3) {
-			red_map = image->map[0];
-			green_map = image->map[1];
-			blue_map = image->map[2];
-		} else {
-			red_map = image->map[0];
-			green_map = image->map[0];
-			blue_map = image->map[0];
-		}
-
-		width = image->width;
-		height = image->height;
-		
-		success = true;
-		for (x = 0; x < width; x++) {
-			for (y = 0; y < height; y++) {
-				color.rgbRed = (BYTE)(red_map[width*y + x]*255);
-				color.rgbGreen = (BYTE)(green_map[width*y + x]*255);
-				color.rgbBlue = (BYTE)(blue_map[width*y + x]*255);
-				success = FreeImage_SetPixelColor(bitmap, x, y, &color);
-				if (!success) break;
-			}
-			if (!success) break;
-		}
-		if (success) {
-			printf("saveImage: color maps were writed into bitmap!\n");
-			if (FreeImage_Save(fif, bitmap, name)) {
-				printf("saveImage: bitmap was successfully saved!\n");
-			} else {
-				printf("saveImage: bitmap couldn\'t be saved\n");
-			}
-		} else {
-			printf("saveImage: couldn\'t set pixel (%d, %d)\n", x, y);
+#else
+	struct stat info; //   
+	void *view; // 
+
+	file->fd = (size > 0) ? open(name, O_RDWR | O_CREAT | O_TRUNC, 0644) : open(name, writable ? O_RDWR : O_RDONLY);
+	if (file->fd < 0) {
+		delete file;
+		return 0;
+	}
+	if (size > 0) {
+		if (ftruncate(file->fd, (off_t)size) != 0) {
+			close(file->fd);
+			delete file;
+			return 0;
 		}
-		FreeImage_Unload(bitmap);
 	} else {
-		printf("saveImage: image was not created\n");
+		fstat(file->fd, &info);
+		size = (size_t)info.st_size;
+	}
+	file->size = size;
+	view = (size == 0) ? MAP_FAILED : mmap(0, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, file->fd, 0);
+	if (view == MAP_FAILED) {
+		close(file->fd);
+		delete file;
+		return 0;
 	}
+	file->header = (RAW_HEADER *)view;
+#endif
+	return file;
 }
 
 /*
- *    
+ *      
  */
-void grayscale(IMAGE *image) {
-	int w, h; //    
-	int size; //   
-	int i; //  
-	double lum; //  
-
-	if (image->channels == 1) {
-		printf("grayscale: image is already grayscale, for what it's worth\n");
-		return;
-	}
-	w = image->width;
-	h = image->height;
-	size = w*h;
+void _raw_views(RAW_FILE *file) {
+	int k; //  
+	char *data; //  
+	size_t plane; //    
 
-	for (i = 0; i < size; i++) {
-		lum = 0.299*(image->map[0][i]) + 0.587*(image->map[1][i]) + 0.114*(image->map[2][i]);
-		if (lum > 1.0) lum = 1.0;
-		image->map[0][i] = lum;
+	data = (char *)file->header + sizeof(RAW_HEADER);
+	plane = (size_t)file->header->width*file->header->height*file->header->sample;
+	file->image.width = file->float_image.width = file->header->width;
+	file->image.height = file->float_image.height = file->header->height;
+	file->image.channels = file->float_image.channels = file->header->channels;
+	for (k = 0; k < 3; k++) {
+		file->image.map[k] = (file->header->sample == 8 && k < file->header->channels) ? (double *)(data + k*plane) : 0;
+		file->float_image.map[k] = (file->header->sample == 4 && k < file->header->channels) ? (float *)(data + k*plane) : 0;
 	}
-	image->channels = 1;
-	delete [] image->map[1];
-	delete [] image->map[2];
 }
 
 /*
- *   
+ *       ,   .
+ *  false   
  */
-void inverse(IMAGE *image) {
-	int w, h; //    
-	int size; //   
-	int channels; //   
-	int i, j; //  
-	double *map; //   
-
-	w = image->width;
-	h = image->height;
-	size = w*h;
-	channels = image->channels;
-	for (j = 0; j < channels; j++) {
-		map = image->map[j];
-		for (i = 0; i < size; i++) {	
-			map[i] = 1.0 - map[i];
-		}
-	}
+bool flushRawFile(RAW_FILE *file) {
+#ifdef _WIN32
+	return FlushViewOfFile(file->header, 0) != 0 && FlushFileBuffers(file->file) != 0;
+#else
+	return msync(file->header, file->size, MS_SYNC) == 0;
+#endif
 }
 
 /*
- *  , 
+ *  .      
  */
-void laplace(IMAGE *image, int type) {
-	int w, h; //    
-	int size; //   
-	int channels; //   
-	int i, j, x, y; //  
-	double *map; //    
-	double *buf; //    
-	double lum; //   
-
-	w = image->width;
-	h = image->height;
-	size = w*h;
-	channels = image->channels;
-
-	for (j = 0; j < channels; j++) { //    
-		printf("laplace: color channel %d\n", j);
-		map = image->map[j];
-		buf = new double[size];
-		for (i = 0; i < size; i++) {
-			buf[i] = map[i];
-		}
-		
-		for (x = 1; x < w - 1; x++) {
-			for (y = 1; y < h - 1; y++) {
-				if (type == (type|FOUR_SIDES)) {
-					lum = 5*buf[y*w+x];
-					lum -= buf[y*w+x+1] + buf[y*w+x-1] + buf[(y+1)*w+x] + buf[(y-1)*w+x];
-					if (lum < 0.0) lum = 0.0;
-					if (lum > 1.0) lum = 1.0;
-					map[y*w+x] = lum;
-				} 
-				else {
-					lum = 9*buf[y*w+x];
-					lum -= buf[y*w+x+1] + buf[y*w+x-1] + buf[(y+1)*w+x] + buf[(y-1)*w+x];
-					lum -= buf[(y+1)*w+x+1] + buf[(y+1)*w+x-1] + buf[(y-1)*w+x+1] + buf[(y-1)*w+x-1];
-					if (lum < 0.0) lum = 0.0;
-					if (lum > 1.0) lum = 1.0;
-					map[y*w+x] = lum;
-				}
-			}
-		}
-		delete [] buf;
+void closeRawFile(RAW_FILE *file) {
+	if (file == 0) {
+		return;
 	}
+#ifdef _WIN32
+	UnmapViewOfFile(file->header);
+	CloseHandle(file->mapping);
+	CloseHandle(file->file);
+#else
+	munmap(file->header, file->size);
+	close(file->fd);
+#endif
+	delete file;
 }
 
 /*
- * 
+ *      :   RAW_HEADER
+ *    ,   IMAGE.    file->image
+ * (double)  file->float_image (float)  ,   .
+ *  writable = false,   
  */
-void _conv(IN double **in_maps, double *h, int channels, int w1, int h1,
-		   int w2, int h2, int a, int b, double div, OUT double **out_maps) {
-	int k, x, y, i, j; //  
-	double *f, *map; //       
-	int border_x, border_y; //      
-	int index_x, index_y; //      . . 
-	double sum; //     
+RAW_FILE *openRawFile(const char *name, bool writable = false) {
+	RAW_FILE *file; //  
+	RAW_HEADER *header; // 
 
-	for (k = 0; k < channels; k++) {
-		f = in_maps[k];
-		map = out_maps[k];
-		for (x = 0; x < w1; x++) {
-			border_x = x - a + w1; // w1      %
-			for (y = 0; y < h1; y++) { //      f
-				border_y = y - b + h1; // h1      %
-				sum = 0;
-				for (i = 0; i < w2; i++) {
-					for (j = 0; j < h2; j++) { //      g
-						index_x = (border_x + i)%w1;
-						index_y = (border_y + j)%h1;
-						sum += h[(h2 - j)*w2 - i - 1]*f[index_y*w1 + index_x];
-					}
-				}
-				map[x + y*w1] = sum/div;
-			}
-		}
-		//printf("conv: done with channel %d\n", k);
+	file = _map_raw_file(name, 0, writable);
+	if (file == 0) {
+		printf("openRawFile: %s was not opened\n", name);
+		return 0;
+	}
+	header = file->header;
+	if (file->size < sizeof(RAW_HEADER) || memcmp(header->magic, RAW_MAGIC, 4) != 0
+		|| header->version != RAW_VERSION || (header->sample != 4 && header->sample != 8)
+		|| header->channels < 1 || header->channels > 3 || header->width < 1 || header->height < 1
+		|| file->size < sizeof(RAW_HEADER) + (size_t)header->width*header->height*header->channels*header->sample) {
+		printf("openRawFile: %s is not an image file\n", name);
+		closeRawFile(file);
+		return 0;
 	}
+	_raw_views(file);
+	return file;
 }
 
 /*
- *    
+ *     ,   .
+ * sample -   : sizeof(float)  sizeof(double)
  */
-IMAGE *conv(IMAGE *image, IMAGE *psf) {
-	int i, j; //  
-	int w1, h1, w2, h2; //      
-	int a, b; //    
-	int channels; //   
-	double *h; //   
-	double div; //  
-	IMAGE *result; //  
+RAW_FILE *createRawFile(const char *name, int width, int height, int channels, int sample) {
+	RAW_FILE *file; //  
 
-	w2 = psf->width;
-	h2 = psf->height;
-
-	if (psf->channels > 1) {
-		printf("conv: PSF should be a grayscale image\n");
+	if ((sample != 4 && sample != 8) || channels < 1 || channels > 3) {
+		printf("createRawFile: wrong sample size %d or channel count %d\n", sample, channels);
 		return 0;
 	}
-	if (w2%2 != 1 || h2%2 != 1) {
-		printf("conv: PSF cannot be of a size (%d, %d)\n", w2, h2);
+	file = _map_raw_file(name, sizeof(RAW_HEADER) + (size_t)width*height*channels*sample, true);
+	if (file == 0) {
+		printf("createRawFile: %s was not created\n", name);
 		return 0;
 	}
-	channels = image->channels;
-	w1 = image->width;
-	h1 = image->height;
-	a = w2/2; //     psf  
-	b = h2/2; //     psf  
-	h = psf->map[0];
+	memset(file->header, 0, sizeof(RAW_HEADER));
+	memcpy(file->header->magic, RAW_MAGIC, 4);
+	file->header->version = RAW_VERSION;
+	file->header->width = width;
+	file->header->height = height;
+	file->header->channels = channels;
+	file->header->sample = sample;
+	_raw_views(file);
+	return file;
+}
 
-	//   
-	div = getPSFDivisor(psf);
-	if (div == 0) {
+/*
+ *    RAW       
+ */
+template <class T>
+RAW_FILE *_write_raw_file(IMAGE_T<T> *image, const char *name, int tag) {
+	RAW_FILE *file; //  
+	int k; //  
+	char *data; //  
+
+	file = createRawFile(name, image->width, image->height, image->channels, sizeof(T));
+	if (file == 0) {
 		return 0;
 	}
-	result = createImage(w1, h1, channels);
-	
-	_conv(image->map, h, channels, w1, h1, w2, h2, a, b, div, result->map);
-
-	return result;
+	file->header->tag = tag;
+	data = (char *)file->header + sizeof(RAW_HEADER);
+	for (k = 0; k < image->channels; k++) {
+		memcpy(data + (size_t)k*image->width*image->height*sizeof(T), image->map[k],
+			(size_t)image->width*image->height*sizeof(T));
+	}
+	return file;
 }
 
 /*
- *     
+ *       . tag  
+ * .  false,    
  */
-IMAGE *deconv(IMAGE *image, IMAGE *psf) {
-	int w1, h1, w2, h2; //    
-	int size1, size2; //     
-	int channels; //    
-	int x, y, i, j, k, t; //  
-	int a, b; //    
-	IMAGE *latent; //  
-	double div; //   
-	double *h, *g, *f; //  
+template <class T>
+bool saveRawImage(IMAGE_T<T> *image, const char *name, int tag = 0) {
+	RAW_FILE *file; //  
 
-	w2 = psf->width;
-	h2 = psf->height;
+	file = _write_raw_file(image, name, tag);
+	if (file == 0) {
+		return false;
+	}
+	closeRawFile(file);
+	return true;
+}
 
-	if (psf->channels > 1) {
-		printf("deconv: PSF should be a grayscale image\n");
+/*
+ *       RAW    T.
+ *  tag  fingerprint,   ,   
+ */
+template <class T>
+IMAGE_T<T> *loadRawImage(const char *name, OUT int *tag = 0, OUT unsigned int *fingerprint = 0) {
+	RAW_FILE *file; //  
+	IMAGE_T<T> *result; //  
+
+	file = openRawFile(name);
+	if (file == 0) {
 		return 0;
 	}
-	if (w2%2 != 1 || h2%2 != 1) {
-		printf("deconv: PSF cannot be of a size (%d, %d)\n", w2, h2);
-		return 0;
+	if (file->header->sample == 8) {
+		result = convertImage<T>(&file->image);
+	} else {
+		result = convertImage<T>(&file->float_image);
 	}
+	if (tag != 0) {
+		*tag = file->header->tag;
+	}
+	if (fingerprint != 0) {
+		*fingerprint = file->header->fingerprint;
+	}
+	closeRawFile(file);
+	return result;
+}
 
-	a = w2/2; //     psf  
-	b = h2/2; //     psf  
-	channels = image->channels;
-	w1 = image->width;
-	h1 = image->height;
-	size1 = w1*h1;
-	size2 = w2*h2;
+/*
+ *  count   : out[k][i] = line[i*stride + offset[k]]*scale
+ */
+template <class S>
+void _read_pixels(const S *line, int stride, const int *offset, double scale, int count,
+				  int channels, OUT double **out) {
+	int i, k; //  
+	const S *src; //   
+	double *dst; //   
 
-	latent = copyImage(image);
-	h = psf->map[0];
+	for (k = 0; k < channels; k++) {
+		src = line + offset[k];
+		dst = out[k];
+		for (i = 0; i < count; i++) {
+			dst[i] = src[i*stride]*scale;
+		}
+	}
+}
 
-	//   
-	div = getPSFDivisor(psf);
-	if (div == 0) {
-		return 0;
+/*
+ *   _read_pixels().       [0, 1].
+ *       
+ */
+template <class S>
+void _write_pixels(S *line, int stride, const int *offset, int bitmap_channels, double scale,
+				   bool integer, int count, int channels, IN double **in) {
+	int i, k; //  
+	S *dst; //   
+	const double *src; //   
+	double value; //  
+
+	for (k = 0; k < bitmap_channels; k++) {
+		dst = line + offset[k];
+		src = in[(channels == 1) ? 0 : k];
+		if (integer) {
+			for (i = 0; i < count; i++) {
+				value = src[i];
+				value = (value < 0.0) ? 0.0 : (value > 1.0) ? 1.0 : value;
+				dst[i*stride] = (S)(value*scale);
+			}
+		} else {
+			for (i = 0; i < count; i++) {
+				dst[i*stride] = (S)src[i];
+			}
+		}
 	}
+}
 
-	double *A;
-	int N, M, NxM; 
-	int pix1, pix2;
-	int border_x, border_y; //      
-	int index_x, index_y; //      . . 
-	double sum; //     
+/*
+ *  count   y ,   x,  out[k][0 ... count - 1].
+ * 8-    24-  32-, 16-  
+ *   ,    8 
+ */
+bool _read_scanline(FIBITMAP *bitmap, int y, int x, int count, int channels, OUT double **out) {
+	static const int rgb[3] = {0, 1, 2}; //    RGB
+	static const int gray[3] = {0, 0, 0}; //  
+	static const int bgr[3] = {FI_RGBA_RED, FI_RGBA_GREEN, FI_RGBA_BLUE}; //   FreeImage
+	BYTE *line; //  
+	int bytes; //    8- 
 
-	N = size1;
-	M = size1 + 1;
-	NxM = N*M;
-	A = new double[NxM];
-	for (i = 0; i < NxM; i++) {
-		A[i] = 0.0;
+	line = FreeImage_GetScanLine(bitmap, y);
+	switch (FreeImage_GetImageType(bitmap)) {
+		case FIT_BITMAP:
+			bytes = FreeImage_GetBPP(bitmap)/8;
+			_read_pixels(line + x*bytes, bytes, bgr, 1.0/255, count, channels, out);
+			return true;
+		case FIT_UINT16:
+			_read_pixels((unsigned short *)line + x, 1, gray, 1.0/65535, count, channels, out);
+			return true;
+		case FIT_RGB16:
+			_read_pixels((unsigned short *)line + 3*x, 3, rgb, 1.0/65535, count, channels, out);
+			return true;
+		case FIT_RGBA16:
+			_read_pixels((unsigned short *)line + 4*x, 4, rgb, 1.0/65535, count, channels, out);
+			return true;
+		case FIT_FLOAT:
+			_read_pixels((float *)line + x, 1, gray, 1.0, count, channels, out);
+			return true;
+		case FIT_RGBF:
+			_read_pixels((float *)line + 3*x, 3, rgb, 1.0, count, channels, out);
+			return true;
+		case FIT_RGBAF:
+			_read_pixels((float *)line + 4*x, 4, rgb, 1.0, count, channels, out);
+			return true;
+		case FIT_DOUBLE:
+			_read_pixels((double *)line + x, 1, gray, 1.0, count, channels, out);
+			return true;
+		default:
+			return false;
 	}
+}
 
-	for (k = 0; k < channels; k++) {
-		printf("deconv: color channel %d...\n", k);
-		g = image->map[k];
-		for (x = 0; x < w1; x++) {
-			border_x = x - a + w1; // w1      %
-			for (y = 0; y < h1; y++) { //      f
-				border_y = y - b + h1; // h1      %
-				pix1 = x + y*w1;
-				sum = 0;
-				for (i = 0; i < w2; i++) {
-					for (j = 0; j < h2; j++) { //      g
-						index_x = (border_x + i)%w1;
-						index_y = (border_y + j)%h1;
-						pix2 = index_x + index_y*w1;
-						A[pix1*M + pix2] = h[j*w2 + i];
-						sum += h[i + j*w2]*g[index_x + index_y*w1];
-					}
-				}
-				printf("assign\n");
-				A[pix1*M + N] = sum/div;
-			}
-		}
+/*
+ *  in[k][0 ... count - 1]   y ,   x
+ */
+bool _write_scanline(FIBITMAP *bitmap, int y, int x, int count, int channels, IN double **in) {
+	static const int rgb[3] = {0, 1, 2}; //    RGB
+	static const int bgr[3] = {FI_RGBA_RED, FI_RGBA_GREEN, FI_RGBA_BLUE}; //   FreeImage
+	BYTE *line; //  
+	int bytes; //    8- 
 
-		//  ,    A
-		double diag_item, first_item, temp;
+	line = FreeImage_GetScanLine(bitmap, y);
+	switch (FreeImage_GetImageType(bitmap)) {
+		case FIT_BITMAP:
+			bytes = FreeImage_GetBPP(bitmap)/8;
+			_write_pixels(line + x*bytes, bytes, bgr, 3, 255.0, true, count, channels, in);
+			return true;
+		case FIT_UINT16:
+			_write_pixels((unsigned short *)line + x, 1, rgb, 1, 65535.0, true, count, channels, in);
+			return true;
+		case FIT_RGB16:
+			_write_pixels((unsigned short *)line + 3*x, 3, rgb, 3, 65535.0, true, count, channels, in);
+			return true;
+		case FIT_FLOAT:
+			_write_pixels((float *)line + x, 1, rgb, 1, 1.0, false, count, channels, in);
+			return true;
+		case FIT_RGBF:
+			_write_pixels((float *)line + 3*x, 3, rgb, 3, 1.0, false, count, channels, in);
+			return true;
+		default:
+			return false;
+	}
+}
 
-		//    
-		for (j = 0; j < N; j++) { //   
-			//   
-			for (i = j; i < N; i++) {
-				diag_item = A[i*M + j];
-				if (diag_item != 0) {
-					break;
-				}
-			}
-			if (diag_item == 0) {
-				printf("deconv: system is incompatible\n");
-			}
-			//    
-			if (i != j) {
-				for (t = j; t < M; t++) {
-					temp = A[i*M + t];
-					A[i*M + t] = A[j*M + t];
-					A[j*M + t] = temp;
-				}
-			}
-			//     
-			A[j*M + j] = 1.0;
-			for (t = j + 1; t < M; t++) { //   
-				A[j*M + t] /= diag_item;
-			}
+/*
+ *     ,   _read_scanline():
+ *   16- 565    24 
+ */
+FIBITMAP *_readable_bitmap(FIBITMAP *bitmap) {
+	FIBITMAP *converted; //   
 
-			//      
-			for (i = j + 1; i < N; i++) { //   
-				first_item = A[i*M + j];
-				A[i*M + j] = 0;
-				for (t = j + 1; t < M; t++) { //    
-					A[i*M + t] -= A[j*M + t]*first_item;
-				}
+	switch (FreeImage_GetImageType(bitmap)) {
+		case FIT_BITMAP:
+			if (FreeImage_GetBPP(bitmap) == 24 || FreeImage_GetBPP(bitmap) == 32) {
+				return bitmap;
 			}
-		}
+			converted = FreeImage_ConvertTo24Bits(bitmap);
+			FreeImage_Unload(bitmap);
+			return converted;
+		case FIT_UINT16:
+		case FIT_RGB16:
+		case FIT_RGBA16:
+		case FIT_FLOAT:
+		case FIT_RGBF:
+		case FIT_RGBAF:
+		case FIT_DOUBLE:
+			return bitmap;
+		default:
+			FreeImage_Unload(bitmap);
+			return 0;
+	}
+}
 
-		//    
-		for (j = N - 1; j > 0; j--) { //      
-			for (i = j - 1; i >= 0; i--) { //      
-				A[i*M + N] -= A[j*M + N]*A[i*M + j];
-			}
-		}
+struct SCANLINE_TASK {
+	FIBITMAP *bitmap; // 
+	IMAGE *image; // 
+};
 
-		//  
-		f = latent->map[k];
-		for (i = 0; i < size1; i++) {
-			f[i] = A[i*M + N];
+/*
+ *   begin ... end - 1    .  
+ *  _readable_bitmap(),    
+ */
+void _load_range(void *context, int begin, int end) {
+	SCANLINE_TASK *task = (SCANLINE_TASK *)context;
+	IMAGE *image = task->image;
+	double *rows[3]; //  
+	int y, k; //  
+
+	for (y = begin; y < end; y++) {
+		for (k = 0; k < image->channels; k++) {
+			rows[k] = image->map[k] + y*image->width;
 		}
+		_read_scanline(task->bitmap, y, 0, image->width, image->channels, rows);
 	}
+}
 
-	return latent;
+/*
+ *   begin ... end - 1    .  
+ * saveImage()   ,   _write_scanline()
+ */
+void _save_range(void *context, int begin, int end) {
+	SCANLINE_TASK *task = (SCANLINE_TASK *)context;
+	IMAGE *image = task->image;
+	double *rows[3]; //  
+	int y, k; //  
+
+	for (y = begin; y < end; y++) {
+		for (k = 0; k < image->channels; k++) {
+			rows[k] = image->map[k] + y*image->width;
+		}
+		_write_scanline(task->bitmap, y, 0, image->width, image->channels, rows);
+	}
 }
 
 /*
- *      
+ *  ,  FreeImage.  8- 
+ * 16-    (PNG, TIFF),    
  */
-COMPLEX_ARRAYS *_form_complex_array(IMAGE *image, int desirable_size = 0) {
-	COMPLEX_ARRAYS *result;
-	comp *mas;
-	double *m;
-	int new_size, size;
-	int i, k, channels;
+IMAGE *loadImage(const char *name, int type) {
+	IMAGE *result; //  
+	FIBITMAP *bitmap; //  FreeImage
+	FREE_IMAGE_FORMAT fif; //  
+	SCANLINE_TASK task; //    
+	TRACE_SCOPE_NOTE("loadImage", name);
 
-	channels = image->channels;
-	size = image->height*image->width;
-	if (desirable_size < size) {
-		desirable_size = size;
+	//     
+	if (type == RAW) {
+		return loadRawImage<double>(name);
+	}
+
+	fif = _image_format(type);
+	if (fif == FIF_UNKNOWN) {
+		printf("loadImage: unknown file format: %d\n", type);
+		return 0;
+	}
+	bitmap = FreeImage_Load(fif, name, 0); //    
+	if (bitmap == 0) {
+		printf("loadImage: %s was not loaded\n", name);
+		return 0;
 	}
-	result = new COMPLEX_ARRAYS();
-	new_size = 1;
-	while(new_size < desirable_size) {
-		new_size *= 2;
+	bitmap = _readable_bitmap(bitmap);
+	if (bitmap == 0) {
+		printf("loadImage: %s has an unsupported pixel type\n", name);
+		return 0;
 	}
 
-	result->size = new_size;
-	for (k = 0; k < channels; k++) {
-		m = image->map[k];
-		mas = new comp[new_size];
-		for (i = 0; i < size; i++) {
-			mas[i].imag(0);
-			mas[i].real(m[i]);
-		}
-		for (i = size; i < new_size; i++) {
-			mas[i].imag(0);
-			mas[i].real(0);
+	result = createTypedImage<double>(FreeImage_GetWidth(bitmap), FreeImage_GetHeight(bitmap), 3, false);
+	task.bitmap = bitmap;
+	task.image = result;
+	parallel_for(result->height, _load_range, &task);
+	FreeImage_Unload(bitmap);
+	return result;
+}
+
+/*
+ *  ,  FreeImage. bits -   :
+ * 8 ( ), 16  32 (   , 
+ *  TIFF). RAW   double,   float  bits = 32.
+ *  false,    
+ */
+bool saveImage(IMAGE *image, const char *name, int type, int bits = 8) {
+	FIBITMAP *bitmap; //  FreeImage
+	bool saved; //    
+	FREE_IMAGE_FORMAT fif; //  
+	FREE_IMAGE_TYPE pixel_type; //   
+	SCANLINE_TASK task; //    
+	TRACE_SCOPE_NOTE("saveImage", name);
+
+	if (image == 0) {
+		printf("saveImage: cannot save image, because it's 0\n");
+		return false;
+	}
+	if (type == RAW) {
+		if (bits == 32) {
+			FLOAT_IMAGE *converted = convertImage<float>(image);
+			saved = saveRawImage(converted, name);
+			deleteImage(converted);
+		} else {
+			saved = saveRawImage(image, name);
 		}
-		result->arrays[k] = mas;
+		return saved;
+	}
+	fif = _image_format(type);
+	if (fif == FIF_UNKNOWN) {
+		printf("saveImage: unknown file format: %d\n", type);
+		return false;
+	}
+	if (bits == 16) {
+		pixel_type = (image->channels == 1) ? FIT_UINT16 : FIT_RGB16;
+	} else if (bits == 32) {
+		pixel_type = (image->channels == 1) ? FIT_FLOAT : FIT_RGBF;
+	} else {
+		pixel_type = FIT_BITMAP;
+	}
+	if (!FreeImage_FIFSupportsExportType(fif, pixel_type)) {
+		printf("saveImage: the format %d cannot store %d bits per channel\n", type, bits);
+		return false;
 	}
 
-	return result;
+	bitmap = FreeImage_AllocateT(pixel_type, image->width, image->height, (pixel_type == FIT_BITMAP) ? 24 : 8);
+	if (bitmap == 0) {
+		printf("saveImage: image was not created\n");
+		return false;
+	}
+	task.bitmap = bitmap;
+	task.image = image;
+	parallel_for(image->height, _save_range, &task);
+	saved = FreeImage_Save(fif, bitmap, name) != 0;
+	if (!saved) {
+		printf("saveImage: %s couldn\'t be saved\n", name);
+	}
+	FreeImage_Unload(bitmap);
+	return saved;
 }
 
 /*
- *   
+ *    
  */
-FOURIER_IMAGE *_FT(IMAGE *image) {
-	FOURIER_IMAGE *fourier_image; //    -
-	comp *comp_map; //   
-	double *map; //   
-	double real, imag, value; //    
-	int index1, index2; //     
-	int w, h; //  
-	int size; //    
-	int sign; // 1  -1    (-1)^(x+y)  
+void grayscale(IMAGE *image) {
+	int w, h; //    
+	int size; //   
+	int i; //  
+	double lum; //  
+
+	if (image->channels == 1) {
+		printf("grayscale: image is already grayscale, for what it's worth\n");
+		return;
+	}
+	w = image->width;
+	h = image->height;
+	size = w*h;
+
+	for (i = 0; i < size; i++) {
+		lum = 0.299*(image->map[0][i]) + 0.587*(image->map[1][i]) + 0.114*(image->map[2][i]);
+		if (lum > 1.0) lum = 1.0;
+		image->map[0][i] = lum;
+	}
+	image->channels = 1;
+	delete [] image->map[1];
+	delete [] image->map[2];
+}
+
+/*
+ *   
+ */
+void inverse(IMAGE *image) {
+	int w, h; //    
+	int size; //   
 	int channels; //   
-	int x, y, u, v, k; //  
+	int i, j; //  
+	double *map; //   
 
 	w = image->width;
 	h = image->height;
 	size = w*h;
 	channels = image->channels;
-	fourier_image = new FOURIER_IMAGE();
-	fourier_image->channels = channels;
-	fourier_image->width = w;
-	fourier_image->height = h;
+	for (j = 0; j < channels; j++) {
+		map = image->map[j];
+		for (i = 0; i < size; i++) {	
+			map[i] = 1.0 - map[i];
+		}
+	}
+}
 
-	for (k = 0; k < channels; k++) {
-		printf("channel: %d, ", k);
-		map = image->map[k];
-		comp_map = new comp[size];
+struct LAPLACE_TASK {
+	double *map; //    
+	double *buf; //    
+	int w, h; //    
+	int type; //  
+};
 
-		printf("to %d: ", w);
-		for (u = 0; u < w; u++) {
-			printf("u = %d\n", u);
-			for (v = 0; v < h; v++) {
-				printf("v = %d\n", v);
-				index2 = v*w + u;
-				real = 0;
-				imag = 0;
-				for (x = 0; x < w; x++) {
-					for (y = 0; y < h; y++) {
-						index1 = y*w + x;
-						sign = 1 - 2*((x+y)%2); //     (-1)^(x+y)
-						real += sign*map[index1]*cos(2*PI*(u*x/w+v*y/h)*(PI/180));
-						imag += -sign*map[index1]*cos(2*PI*(u*x/w+v*y/h)*(PI/180));
-					}
-				}
-				comp_map[index2].real(real/size);
-				comp_map[index2].imag(imag/size);
+/*
+ *     begin + 1 ... end
+ */
+void _laplace_range(void *context, int begin, int end) {
+	LAPLACE_TASK *task = (LAPLACE_TASK *)context;
+	int w, h; //    
+	int x, y; //  
+	int type; //  
+	double *map, *buf; //      
+	double lum; //   
+
+	w = task->w;
+	h = task->h;
+	type = task->type;
+	map = task->map;
+	buf = task->buf;
+	for (x = begin + 1; x < end + 1; x++) {
+		for (y = 1; y < h - 1; y++) {
+			if (type == (type|FOUR_SIDES)) {
+				lum = 5*buf[y*w+x];
+				lum -= buf[y*w+x+1] + buf[y*w+x-1] + buf[(y+1)*w+x] + buf[(y-1)*w+x];
+				if (lum < 0.0) lum = 0.0;
+				if (lum > 1.0) lum = 1.0;
+				map[y*w+x] = lum;
+			} 
+			else {
+				lum = 9*buf[y*w+x];
+				lum -= buf[y*w+x+1] + buf[y*w+x-1] + buf[(y+1)*w+x] + buf[(y-1)*w+x];
+				lum -= buf[(y+1)*w+x+1] + buf[(y+1)*w+x-1] + buf[(y-1)*w+x+1] + buf[(y-1)*w+x-1];
+				if (lum < 0.0) lum = 0.0;
+				if (lum > 1.0) lum = 1.0;
+				map[y*w+x] = lum;
 			}
 		}
-		fourier_image->map[k] = comp_map;
-		printf("\n");
 	}
-	printf("\n");
-
-	return fourier_image;
 }
 
 /*
- *   
+ *  , 
  */
-IMAGE *_IFT(FOURIER_IMAGE *fourier_image) {
-	IMAGE *image; // 
-	comp *comp_map; //   
-	comp value; //    
-	double *map; //   
-	double real;  //    
-	int index1, index2; //     
-	int w, h; //  
-	int size; //    
-	int sign; // 1  -1    (-1)^(x+y)  
+void laplace(IMAGE *image, int type) {
+	int w, h; //    
+	int size; //   
 	int channels; //   
-	int x, y, u, v, k; //  
+	int j; //  
+	LAPLACE_TASK task; //    
+	TRACE_SCOPE("laplace");
 
-	w = fourier_image->width;
-	h = fourier_image->height;
+	w = image->width;
+	h = image->height;
 	size = w*h;
-	channels = fourier_image->channels;
-	image = new IMAGE();
-	image->channels = channels;
-	image->width = w;
-	image->height = h;
+	channels = image->channels;
+	task.w = w;
+	task.h = h;
+	task.type = type;
+	task.buf = (double *)thread_scratch(LAPLACE_SCRATCH, size*sizeof(double));
+	TRACE_COUNT(TRACE_FLOPS, ((type == EIGHT_SIDES) ? 9.0 : 5.0)*channels*size);
+	TRACE_COUNT(TRACE_BYTES, 3.0*channels*size*sizeof(double));
 
-	for (k = 0; k < channels; k++) {
-		printf("channel: %d, ", k);
-		comp_map = fourier_image->map[k];
-		map = new double[size];
+	for (j = 0; j < channels; j++) { //    
+		task.map = image->map[j];
+		memcpy(task.buf, task.map, size*sizeof(double));
+		parallel_for(w - 2, _laplace_range, &task);
+	}
+}
 
-		printf("to %d: ", w);
-		for (x = 0; x < w; x++) {
-			printf("%d ", x);
-			for (y = 0; y < h; y++) {
-				index1 = y*w + x;
-				real = 0;
-				for (u = 0; u < w; u++) {
-					for (v = 0; v < h; v++) {
-						index2 = v*w + u;
-						value.real(cos(2*PI*(u*x/w+v*y/h)*(PI/180)));
-						value.imag(sin(2*PI*(u*x/w+v*y/h)*(PI/180)));
-						real += (comp_map[index2]*value).real();
-					}
+/*
+ * acc[x] += weight*src[x]  x = 0 ... n - 1.    
+ */
+void _axpy(double *acc, const double *src, double weight, int n) {
+	int x; //  
+
+	for (x = 0; x < n; x++) {
+		acc[x] += weight*src[x];
+	}
+}
+
+#ifdef DFT_X86
+DFT_TARGET("sse2")
+void _axpy_sse2(double *acc, const double *src, double weight, int n) {
+	int x; //  
+	__m128d w; //     
+
+	w = _mm_set1_pd(weight);
+	for (x = 0; x + 2 <= n; x += 2) {
+		_mm_storeu_pd(acc + x, _mm_add_pd(_mm_loadu_pd(acc + x), _mm_mul_pd(w, _mm_loadu_pd(src + x))));
+	}
+	for (; x < n; x++) {
+		acc[x] += weight*src[x];
+	}
+}
+
+#ifdef DFT_HAVE_AVX2
+DFT_TARGET("avx2")
+void _axpy_avx2(double *acc, const double *src, double weight, int n) {
+	int x; //  
+	__m256d w; //     
+
+	w = _mm256_set1_pd(weight);
+	for (x = 0; x + 4 <= n; x += 4) {
+		_mm256_storeu_pd(acc + x, _mm256_add_pd(_mm256_loadu_pd(acc + x),
+			_mm256_mul_pd(w, _mm256_loadu_pd(src + x))));
+	}
+	for (; x < n; x++) {
+		acc[x] += weight*src[x];
+	}
+}
+#endif
+#endif
+
+typedef void (*AXPY_FUNCTION)(double *acc, const double *src, double weight, int n);
+
+/*
+ *   _axpy()  ,   
+ */
+AXPY_FUNCTION _axpy_function() {
+#ifdef DFT_X86
+#ifdef DFT_HAVE_AVX2
+	if (fft_instruction_set() >= FFT_AVX2) {
+		return _axpy_avx2;
+	}
+#endif
+	if (fft_instruction_set() >= FFT_SSE2) {
+		return _axpy_sse2;
+	}
+#endif
+	return _axpy;
+}
+
+template <class T>
+struct CONV_TASK {
+	T **in_maps, **out_maps; //      
+	double *h; //  : h[j*w2 + i]   f(x - a + i, y - b + j)
+	int w1, h1, w2, h2; //    
+	int a, b; //    
+	double div; //  
+	AXPY_FUNCTION axpy; //  
+};
+
+/*
+ *    begin ... end - 1  ,  .
+ *   :      
+ *       a,  , 
+ *       %,  .   
+ *   CONV_TILE ,        ,
+ *          .
+ *          
+ */
+template <class T>
+void _conv_range(void *context, int begin, int end) {
+	CONV_TASK<T> *task = (CONV_TASK<T> *)context;
+	int n, k, x, y, i, j, x0; //  
+	int w1, h1, w2, h2, a, b; //    ,    
+	int line_width; //    
+	int row, slot; //           
+	int tile; //   
+	T *f, *map; //      
+	double *lines; //   h2   
+	int *tags; //       
+	int channel; // ,     
+	double *acc; //     
+	double *line; //   
+
+	w1 = task->w1;
+	h1 = task->h1;
+	w2 = task->w2;
+	h2 = task->h2;
+	a = task->a;
+	b = task->b;
+	line_width = w1 + 2*a;
+	lines = (double *)thread_scratch(CONV_SCRATCH, (h2*line_width + w1)*sizeof(double) + h2*sizeof(int));
+	acc = lines + h2*line_width;
+	tags = (int *)(acc + w1);
+	channel = -1;
+
+	for (n = begin; n < end; n++) {
+		k = n/h1;
+		y = n%h1;
+		map = task->out_maps[k];
+		if (k != channel) {
+			channel = k;
+			for (j = 0; j < h2; j++) {
+				tags[j] = INT_MIN;
+			}
+		}
+
+		//      
+		for (j = 0; j < h2; j++) {
+			row = y - b + j;
+			slot = (row%h2 + h2)%h2;
+			if (tags[slot] != row) {
+				tags[slot] = row;
+				line = lines + slot*line_width;
+				f = task->in_maps[k] + ((row%h1 + h1)%h1)*w1;
+				for (x = 0; x < a; x++) {
+					line[x] = f[((x - a)%w1 + w1)%w1];
+					line[a + w1 + x] = f[x%w1];
+				}
+				for (x = 0; x < w1; x++) {
+					line[a + x] = f[x];
+				}
+			}
+		}
+
+		for (x0 = 0; x0 < w1; x0 += CONV_TILE) {
+			tile = (w1 - x0 < CONV_TILE) ? w1 - x0 : CONV_TILE;
+			for (x = 0; x < tile; x++) {
+				acc[x0 + x] = 0;
+			}
+			for (j = 0; j < h2; j++) {
+				row = y - b + j;
+				line = lines + ((row%h2 + h2)%h2)*line_width + x0;
+				for (i = 0; i < w2; i++) {
+					if (task->h[j*w2 + i] != 0) {
+						task->axpy(acc + x0, line + i, task->h[j*w2 + i], tile);
+					}
+				}
+			}
+		}
+		for (x = 0; x < w1; x++) {
+			map[y*w1 + x] = (T)(acc[x]/task->div);
+		}
+	}
+}
+
+/*
+ *     h (  )
+ */
+template <class T>
+void _conv(IN T **in_maps, double *h, int channels, int w1, int h1,
+		   int w2, int h2, int a, int b, double div, OUT T **out_maps) {
+	CONV_TASK<T> task; //    
+	TRACE_SCOPE("direct conv");
+	TRACE_COUNT(TRACE_FLOPS, 2.0*channels*w1*h1*w2*h2);
+	TRACE_COUNT(TRACE_BYTES, 2.0*channels*w1*h1*sizeof(T));
+
+	task.h = h;
+	task.in_maps = in_maps;
+	task.out_maps = out_maps;
+	task.w1 = w1;
+	task.h1 = h1;
+	task.w2 = w2;
+	task.h2 = h2;
+	task.a = a;
+	task.b = b;
+	task.div = div;
+	task.axpy = _axpy_function();
+	parallel_for(channels*h1, _conv_range<T>, &task);
+}
+
+template <class T>
+struct MAPS_TASK {
+	T **dst, **src; //  
+	int width; //    
+	int height; //    
+	double *rows; //          0
+};
+
+/*
+ *  I-   g   hf. ,  
+ *  ,  
+ */
+inline double _divergence(double g, double hf) {
+	if (hf <= 0) {
+		return 0.0;
+	}
+	return ((g > 0) ? g*log(g/hf) : 0.0) - g + hf;
+}
+
+/*
+ * dst = src/dst   begin ... end - 1  
+ */
+template <class T>
+void _divide_range(void *context, int begin, int end) {
+	MAPS_TASK<T> *task = (MAPS_TASK<T> *)context;
+	int n, i; //  
+	T *dst, *src; //   
+
+	for (n = begin; n < end; n++) {
+		dst = task->dst[n/task->height] + (n%task->height)*task->width;
+		src = task->src[n/task->height] + (n%task->height)*task->width;
+		for (i = 0; i < task->width; i++) {
+			dst[i] = (dst[i] != 0) ? src[i]/dst[i] : 0;
+		}
+	}
+}
+
+/*
+ *     : (g - h*f)^2, g^2  I-,  src = g,
+ *  dst   - h*f
+ */
+template <class T>
+void _divide_metrics_range(void *context, int begin, int end) {
+	MAPS_TASK<T> *task = (MAPS_TASK<T> *)context;
+	int n, i; //  
+	T *dst, *src; //   
+	double residual, norm, divergence; //   
+	double g, hf; //    
+
+	for (n = begin; n < end; n++) {
+		dst = task->dst[n/task->height] + (n%task->height)*task->width;
+		src = task->src[n/task->height] + (n%task->height)*task->width;
+		residual = 0.0;
+		norm = 0.0;
+		divergence = 0.0;
+		for (i = 0; i < task->width; i++) {
+			g = src[i];
+			hf = dst[i];
+			residual += (g - hf)*(g - hf);
+			norm += g*g;
+			divergence += _divergence(g, hf);
+			dst[i] = (dst[i] != 0) ? src[i]/dst[i] : 0;
+		}
+		task->rows[3*n] = residual;
+		task->rows[3*n + 1] = norm;
+		task->rows[3*n + 2] = divergence;
+	}
+}
+
+/*
+ * dst = dst*src   begin ... end - 1  
+ */
+template <class T>
+void _multiply_range(void *context, int begin, int end) {
+	MAPS_TASK<T> *task = (MAPS_TASK<T> *)context;
+	int n, i; //  
+	T *dst, *src; //   
+
+	for (n = begin; n < end; n++) {
+		dst = task->dst[n/task->height] + (n%task->height)*task->width;
+		src = task->src[n/task->height] + (n%task->height)*task->width;
+		for (i = 0; i < task->width; i++) {
+			dst[i] = dst[i]*src[i];
+		}
+	}
+}
+
+/*
+ *     : (dst*src - dst)^2  dst^2  
+ */
+template <class T>
+void _multiply_metrics_range(void *context, int begin, int end) {
+	MAPS_TASK<T> *task = (MAPS_TASK<T> *)context;
+	int n, i; //  
+	T *dst, *src; //   
+	double change, norm; //   
+	double f, step; //    
+
+	for (n = begin; n < end; n++) {
+		dst = task->dst[n/task->height] + (n%task->height)*task->width;
+		src = task->src[n/task->height] + (n%task->height)*task->width;
+		change = 0.0;
+		norm = 0.0;
+		for (i = 0; i < task->width; i++) {
+			f = dst[i];
+			dst[i] = dst[i]*src[i];
+			step = dst[i] - f;
+			change += step*step;
+			norm += f*f;
+		}
+		task->rows[3*n] = change;
+		task->rows[3*n + 1] = norm;
+		task->rows[3*n + 2] = 0.0;
+	}
+}
+
+/*
+ *       .  
+ * rows (3*channels*h ),       
+ * 
+ */
+template <class T>
+void _divide_maps(IN T **src, T **dst, int channels, int w, int h, OUT double *rows = 0) {
+	MAPS_TASK<T> task = { dst, src, w, h, rows };
+	TRACE_SCOPE("divide");
+	TRACE_COUNT(TRACE_FLOPS, ((rows != 0) ? 12.0 : 1.0)*channels*w*h);
+	TRACE_COUNT(TRACE_BYTES, 3.0*channels*w*h*sizeof(T));
+	if (rows != 0) {
+		parallel_for(channels*h, _divide_metrics_range<T>, &task);
+	} else {
+		parallel_for(channels*h, _divide_range<T>, &task);
+	}
+}
+
+template <class T>
+void _multiply_maps(T **dst, IN T **src, int channels, int w, int h, OUT double *rows = 0) {
+	MAPS_TASK<T> task = { dst, src, w, h, rows };
+	TRACE_SCOPE("multiply");
+	TRACE_COUNT(TRACE_FLOPS, ((rows != 0) ? 5.0 : 1.0)*channels*w*h);
+	TRACE_COUNT(TRACE_BYTES, 3.0*channels*w*h*sizeof(T));
+	if (rows != 0) {
+		parallel_for(channels*h, _multiply_metrics_range<T>, &task);
+	} else {
+		parallel_for(channels*h, _multiply_range<T>, &task);
+	}
+}
+
+/*
+ *  index-  count ,  stride   . 
+ *      
+ */
+double _sum_rows(IN double *rows, int count, int index, int stride = 3) {
+	int n; //  
+	double sum; // 
+
+	sum = 0.0;
+	for (n = 0; n < count; n++) {
+		sum += rows[stride*n + index];
+	}
+	return sum;
+}
+
+/*
+ *         (w1, h1).
+ *           
+ * ,        _conv()
+ */
+FFT_KERNEL *createFFTKernel(IMAGE *psf, int w1, int h1) {
+	FFT_KERNEL *kernel; //  
+	int w2, h2; //  
+	int a, b; //    
+	int fw, fh; //   
+	int i, j, x, y; //  
+	double *h; //   
+
+	w2 = psf->width;
+	h2 = psf->height;
+	a = w2/2;
+	b = h2/2;
+	h = psf->map[0];
+	fw = convolution_size(w1, w2);
+	fh = convolution_size(h1, h2);
+
+	kernel = new FFT_KERNEL();
+	kernel->width = w1;
+	kernel->height = h1;
+	kernel->fft_width = fw;
+	kernel->fft_height = fh;
+	kernel->spectrum_size = (fw/2 + 1)*fh;
+	kernel->div = getPSFDivisor(psf);
+	kernel->spectrum = new comp[kernel->spectrum_size];
+	kernel->buf = new comp[kernel->spectrum_size];
+	kernel->area = new double[fw*fh];
+	kernel->index_x = new int[fw];
+	kernel->index_y = new int[fh];
+	TRACE_ALLOC(2.0*kernel->spectrum_size*sizeof(comp) + (double)fw*fh*sizeof(double));
+
+	//        ,
+	//     
+	for (x = 0; x < fw; x++) {
+		i = (x < fw - a) ? x : x - fw;
+		kernel->index_x[x] = (i%w1 + w1)%w1;
+	}
+	for (y = 0; y < fh; y++) {
+		j = (y < fh - b) ? y : y - fh;
+		kernel->index_y[y] = (j%h1 + h1)%h1;
+	}
+
+	//      
+	for (i = 0; i < fw*fh; i++) {
+		kernel->area[i] = 0.0;
+	}
+	for (i = 0; i < w2; i++) {
+		for (j = 0; j < h2; j++) {
+			x = (i - a + fw)%fw;
+			y = (j - b + fh)%fh;
+			kernel->area[y*fw + x] = h[j*w2 + i];
+		}
+	}
+	real_fourier_transform_2d(kernel->area, kernel->spectrum, fw, fh);
+	return kernel;
+}
+
+/*
+ *   
+ */
+void deleteFFTKernel(FFT_KERNEL *kernel) {
+	if (kernel == 0) {
+		return;
+	}
+	TRACE_FREE(2.0*kernel->spectrum_size*sizeof(comp) + (double)kernel->fft_width*kernel->fft_height*sizeof(double));
+	delete [] kernel->spectrum;
+	delete [] kernel->buf;
+	delete [] kernel->area;
+	delete [] kernel->index_x;
+	delete [] kernel->index_y;
+	delete kernel;
+}
+
+template <class T>
+struct SPECTRUM_TASK {
+	FFT_KERNEL *kernel; //     
+	T *f; //   
+	double div; //  
+};
+
+/*
+ *   begin ... end - 1  
+ */
+template <class T>
+void _fill_area_range(void *context, int begin, int end) {
+	SPECTRUM_TASK<T> *task = (SPECTRUM_TASK<T> *)context;
+	FFT_KERNEL *kernel = task->kernel;
+	int x, y; //  
+	int w1, fw; //      
+	T *row; //   
+
+	w1 = kernel->width;
+	fw = kernel->fft_width;
+	for (y = begin; y < end; y++) {
+		row = task->f + kernel->index_y[y]*w1;
+		for (x = 0; x < fw; x++) {
+			kernel->area[y*fw + x] = row[kernel->index_x[x]];
+		}
+	}
+}
+
+/*
+ *   begin ... end - 1      
+ */
+template <class T>
+void _read_area_range(void *context, int begin, int end) {
+	SPECTRUM_TASK<T> *task = (SPECTRUM_TASK<T> *)context;
+	FFT_KERNEL *kernel = task->kernel;
+	int x, y; //  
+	int w1, fw; //      
+
+	w1 = kernel->width;
+	fw = kernel->fft_width;
+	for (y = begin; y < end; y++) {
+		for (x = 0; x < w1; x++) {
+			task->f[y*w1 + x] = (T)(kernel->area[y*fw + x]/task->div);
+		}
+	}
+}
+
+/*
+ *          
+ *     kernel->buf
+ */
+template <class T>
+void _image_spectrum(IN T *f, FFT_KERNEL *kernel) {
+	SPECTRUM_TASK<T> task = { kernel, f, 1.0 };
+
+	parallel_for(kernel->fft_height, _fill_area_range<T>, &task);
+	real_fourier_transform_2d(kernel->area, kernel->buf, kernel->fft_width, kernel->fft_height);
+}
+
+/*
+ *        kernel->buf
+ */
+template <class T>
+void _spectrum_image(FFT_KERNEL *kernel, double div, OUT T *f) {
+	SPECTRUM_TASK<T> task = { kernel, f, div };
+
+	inverse_real_fourier_transform_2d(kernel->buf, kernel->area, kernel->fft_width, kernel->fft_height);
+	parallel_for(kernel->height, _read_area_range<T>, &task);
+}
+
+/*
+ *         
+ */
+template <class T>
+void _fftconv(IN T **in_maps, FFT_KERNEL *kernel, int channels, OUT T **out_maps) {
+	int k; //  
+	TRACE_SCOPE("fft conv");
+	TRACE_COUNT(TRACE_FLOPS, 6.0*channels*kernel->spectrum_size);
+	TRACE_COUNT(TRACE_BYTES, channels*(3.0*kernel->spectrum_size*sizeof(comp)
+		+ 2.0*kernel->width*kernel->height*sizeof(T)));
+
+	for (k = 0; k < channels; k++) {
+		_image_spectrum(in_maps[k], kernel);
+		multiply(kernel->buf, kernel->spectrum, kernel->buf, kernel->spectrum_size);
+		_spectrum_image(kernel, kernel->div, out_maps[k]);
+	}
+}
+
+/*
+ *    a  m x n ( )  :
+ *  a ,    ,   
+ *   v (n x n).    j  a  s[j]*u_j
+ */
+void _svd(double *a, int m, int n, OUT double *s, OUT double *v) {
+	int i, j, k, sweep; //  
+	double alpha, beta, gamma; //       
+	double zeta, t, c, sn; //  
+	double x, y; //   
+	bool rotated; //      
+
+	for (i = 0; i < n*n; i++) {
+		v[i] = 0;
+	}
+	for (i = 0; i < n; i++) {
+		v[i*n + i] = 1;
+	}
+	for (sweep = 0; sweep < 60; sweep++) {
+		rotated = false;
+		for (i = 0; i < n - 1; i++) {
+			for (j = i + 1; j < n; j++) {
+				alpha = 0;
+				beta = 0;
+				gamma = 0;
+				for (k = 0; k < m; k++) {
+					alpha += a[k*n + i]*a[k*n + i];
+					beta += a[k*n + j]*a[k*n + j];
+					gamma += a[k*n + i]*a[k*n + j];
+				}
+				if (fabs(gamma) <= 1e-15*sqrt(alpha*beta)) {
+					continue;
+				}
+				rotated = true;
+				zeta = (beta - alpha)/(2*gamma);
+				t = ((zeta >= 0) ? 1 : -1)/(fabs(zeta) + sqrt(1 + zeta*zeta));
+				c = 1/sqrt(1 + t*t);
+				sn = c*t;
+				for (k = 0; k < m; k++) {
+					x = a[k*n + i];
+					y = a[k*n + j];
+					a[k*n + i] = c*x - sn*y;
+					a[k*n + j] = sn*x + c*y;
+				}
+				for (k = 0; k < n; k++) {
+					x = v[k*n + i];
+					y = v[k*n + j];
+					v[k*n + i] = c*x - sn*y;
+					v[k*n + j] = sn*x + c*y;
+				}
+			}
+		}
+		if (!rotated) {
+			break;
+		}
+	}
+	for (j = 0; j < n; j++) {
+		s[j] = 0;
+		for (k = 0; k < m; k++) {
+			s[j] += a[k*n + j]*a[k*n + j];
+		}
+		s[j] = sqrt(s[j]);
+	}
+}
+
+/*
+ *     rank    ,
+ * psf(p, q) = sum column[r*h2 + q]*row[r*w2 + p],   ,
+ *         tolerance.
+ *  rank.     1,   - 
+ * 
+ */
+int separatePSF(IMAGE *psf, double tolerance, OUT double **row, OUT double **column) {
+	int w2, h2; //  
+	int rank; //   
+	int i, j, r, best; //  
+	double *a, *s, *v; //  
+	int *order; //     
+	double total, rest; //       
+
+	w2 = psf->width;
+	h2 = psf->height;
+	a = new double[w2*h2];
+	s = new double[w2];
+	v = new double[w2*w2];
+	order = new int[w2];
+	for (i = 0; i < w2*h2; i++) {
+		a[i] = psf->map[0][i];
+	}
+	_svd(a, h2, w2, s, v);
+
+	//  : w2 
+	total = 0;
+	for (i = 0; i < w2; i++) {
+		order[i] = i;
+		total += s[i]*s[i];
+	}
+	for (i = 0; i < w2; i++) {
+		best = i;
+		for (j = i + 1; j < w2; j++) {
+			if (s[order[j]] > s[order[best]]) {
+				best = j;
+			}
+		}
+		j = order[i];
+		order[i] = order[best];
+		order[best] = j;
+	}
+	rest = total;
+	for (rank = 0; rank < w2; rank++) {
+		if (rest <= tolerance*tolerance*total) {
+			break;
+		}
+		rest -= s[order[rank]]*s[order[rank]];
+	}
+	if (rank == 0) {
+		rank = 1;
+	}
+
+	*row = new double[rank*w2];
+	*column = new double[rank*h2];
+	for (r = 0; r < rank; r++) {
+		for (i = 0; i < w2; i++) {
+			(*row)[r*w2 + i] = v[i*w2 + order[r]];
+		}
+		for (j = 0; j < h2; j++) {
+			(*column)[r*h2 + j] = a[j*w2 + order[r]];
+		}
+	}
+	delete [] a;
+	delete [] s;
+	delete [] v;
+	delete [] order;
+	return rank;
+}
+
+template <class T>
+struct SEPARABLE_TASK {
+	T *in, *out; //   
+	CONV_PLAN *plan; //  
+	int r; //  
+	bool last; //   
+};
+
+/*
+ *   begin ... end - 1    r.  
+ *    ,       %.
+ *     
+ */
+template <class T>
+void _row_pass_range(void *context, int begin, int end) {
+	SEPARABLE_TASK<T> *task = (SEPARABLE_TASK<T> *)context;
+	CONV_PLAN *plan = task->plan;
+	int x, y, i; //  
+	int w1, w2, a; //  ,    
+	double *line; //    
+	double *row; //   
+	double *out; //  
+	double sum; //     
+
+	w1 = plan->w1;
+	w2 = plan->w2;
+	a = plan->a;
+	line = (double *)thread_scratch(CONV_SCRATCH, (w1 + 2*a + w2)*sizeof(double));
+	row = line + w1 + 2*a;
+	for (i = 0; i < w2; i++) {
+		row[i] = plan->row[task->r*w2 + w2 - 1 - i];
+	}
+	for (y = begin; y < end; y++) {
+		for (x = 0; x < w1 + 2*a; x++) {
+			line[x] = task->in[y*w1 + ((x - a)%w1 + w1)%w1];
+		}
+		out = plan->buf + y*w1;
+		for (x = 0; x < w1; x++) {
+			sum = 0;
+			for (i = 0; i < w2; i++) {
+				sum += row[i]*line[x + i];
+			}
+			out[x] = sum;
+		}
+	}
+}
+
+/*
+ *      r   begin ... end - 1. 
+ *  ,    .  
+ *     
+ */
+template <class T>
+void _column_pass_range(void *context, int begin, int end) {
+	SEPARABLE_TASK<T> *task = (SEPARABLE_TASK<T> *)context;
+	CONV_PLAN *plan = task->plan;
+	int x, y, j; //  
+	int w1, h1, h2, b; //  ,    
+	double *column; //  
+	double *rows; //    
+	double *sum, *line; //       
+	double weight; //  
+
+	w1 = plan->w1;
+	h1 = plan->h1;
+	h2 = plan->h2;
+	b = plan->b;
+	column = plan->column + task->r*h2;
+	rows = plan->buf;
+	for (y = begin; y < end; y++) {
+		sum = plan->buf + w1*h1 + y*w1;
+		if (task->r == 0) {
+			for (x = 0; x < w1; x++) {
+				sum[x] = 0;
+			}
+		}
+		for (j = 0; j < h2; j++) {
+			weight = column[h2 - 1 - j];
+			line = rows + ((y - b + j)%h1 + h1)%h1*w1;
+			for (x = 0; x < w1; x++) {
+				sum[x] += weight*line[x];
+			}
+		}
+		if (task->last) {
+			for (x = 0; x < w1; x++) {
+				task->out[y*w1 + x] = (T)(sum[x]/plan->div);
+			}
+		}
+	}
+}
+
+/*
+ *         : O(rank*(w2 + h2))
+ *     O(w2*h2)
+ */
+template <class T>
+void _sepconv(IN T **in_maps, CONV_PLAN *plan, int channels, OUT T **out_maps) {
+	SEPARABLE_TASK<T> task; //    
+	int k, r; //  
+	TRACE_SCOPE("separable conv");
+	TRACE_COUNT(TRACE_FLOPS, 2.0*channels*plan->w1*plan->h1*(plan->w2 + plan->h2)*plan->rank);
+	TRACE_COUNT(TRACE_BYTES, 4.0*channels*plan->w1*plan->h1*plan->rank*sizeof(double));
+
+	task.plan = plan;
+	for (k = 0; k < channels; k++) {
+		task.in = in_maps[k];
+		task.out = out_maps[k];
+		for (r = 0; r < plan->rank; r++) {
+			task.r = r;
+			task.last = (r == plan->rank - 1);
+			parallel_for(plan->h1, _row_pass_range<T>, &task);
+			parallel_for(plan->h1, _column_pass_range<T>, &task);
+		}
+	}
+}
+
+/*
+ *     ( CONV_AUTO)
+ */
+CONV_PLAN *_make_conv_plan(IMAGE *psf, int w1, int h1, int method) {
+	CONV_PLAN *plan; //  
+	int i; //  
+	TRACE_SCOPE("conv plan");
+
+	plan = new CONV_PLAN();
+	plan->method = method;
+	plan->requested = method;
+	plan->h = 0;
+	plan->w1 = w1;
+	plan->h1 = h1;
+	plan->w2 = psf->width;
+	plan->h2 = psf->height;
+	plan->a = psf->width/2;
+	plan->b = psf->height/2;
+	plan->div = getPSFDivisor(psf);
+	plan->kernel = 0;
+	plan->rank = 0;
+	plan->row = 0;
+	plan->column = 0;
+	plan->buf = 0;
+	if (method == CONV_FFT) {
+		plan->kernel = createFFTKernel(psf, w1, h1);
+	}
+	if (method == CONV_SEPARABLE) {
+		plan->rank = separatePSF(psf, SEPARABLE_TOLERANCE, &plan->row, &plan->column);
+		if (plan->rank*(plan->w2 + plan->h2) < plan->w2*plan->h2) {
+			plan->buf = new double[2*w1*h1];
+		} else {
+			//   ,    
+			delete [] plan->row;
+			delete [] plan->column;
+			plan->row = 0;
+			plan->column = 0;
+		}
+	}
+
+	//       ,     
+	if (method != CONV_FFT && plan->row == 0) {
+		plan->h = new double[plan->w2*plan->h2];
+		for (i = 0; i < plan->w2*plan->h2; i++) {
+			plan->h[i] = psf->map[0][plan->w2*plan->h2 - 1 - i];
+		}
+	}
+	return plan;
+}
+
+/*
+ *   
+ */
+void deleteConvPlan(CONV_PLAN *plan) {
+	if (plan == 0) {
+		return;
+	}
+	deleteFFTKernel(plan->kernel);
+	delete [] plan->h;
+	delete [] plan->row;
+	delete [] plan->column;
+	delete [] plan->buf;
+	delete plan;
+}
+
+/*
+ *    
+ */
+template <class T>
+void _convplan(IN T **in_maps, CONV_PLAN *plan, int channels, OUT T **out_maps) {
+	if (plan->method == CONV_FFT) {
+		_fftconv(in_maps, plan->kernel, channels, out_maps);
+	} else if (plan->row != 0) {
+		_sepconv(in_maps, plan, channels, out_maps);
+	} else {
+		_conv(in_maps, plan->h, channels, plan->w1, plan->h1, plan->w2, plan->h2,
+			plan->a, plan->b, plan->div, out_maps);
+	}
+}
+
+CONV_CHOICE *conv_profile = 0; //   
+int conv_profile_count = 0; //  
+int conv_profile_capacity = 0; //   
+bool conv_profile_loaded = false; //    
+const char *conv_profile_name = CONV_PROFILE; //  , 0 -  
+MUTEX conv_profile_mutex; //     
+
+/*
+ *       ( )
+ */
+double _wall_time() {
+#ifdef _WIN32
+	LARGE_INTEGER counter, frequency; //     
+
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+	return (double)counter.QuadPart/(double)frequency.QuadPart;
+#else
+	struct timeval now; //  
+
+	gettimeofday(&now, 0);
+	return now.tv_sec + now.tv_usec*1e-6;
+#endif
+}
+
+/*
+ *     
+ */
+void _add_conv_choice(CONV_CHOICE *choice) {
+	int i; //  
+	CONV_CHOICE *profile; //   
+
+	if (conv_profile_count == conv_profile_capacity) {
+		conv_profile_capacity = (conv_profile_capacity == 0) ? 16 : 2*conv_profile_capacity;
+		profile = new CONV_CHOICE[conv_profile_capacity];
+		for (i = 0; i < conv_profile_count; i++) {
+			profile[i] = conv_profile[i];
+		}
+		delete [] conv_profile;
+		conv_profile = profile;
+	}
+	conv_profile[conv_profile_count++] = *choice;
+}
+
+/*
+ *   .  : w1 h1 w2 h2 rank threads method
+ */
+void _load_conv_profile() {
+	FILE *file; //  
+	CONV_CHOICE choice; //  
+	char line[256]; //  
+
+	conv_profile_loaded = true;
+	if (conv_profile_name == 0) {
+		return;
+	}
+	file = fopen(conv_profile_name, "r");
+	if (file == 0) {
+		return;
+	}
+	while (fgets(line, sizeof(line), file) != 0) {
+		if (sscanf(line, "%d %d %d %d %d %d %d", &choice.w1, &choice.h1, &choice.w2, &choice.h2,
+			&choice.rank, &choice.threads, &choice.method) == 7) {
+			_add_conv_choice(&choice);
+		}
+	}
+	fclose(file);
+}
+
+/*
+ *     CONV_PROFILE. 0 -   .
+ *    
+ */
+void setConvProfile(const char *name) {
+	conv_profile_mutex.lock();
+	conv_profile_name = name;
+	conv_profile_count = 0;
+	conv_profile_loaded = false;
+	conv_profile_mutex.unlock();
+}
+
+/*
+ *      (w1, h1)  .
+ *     :     .  
+ *           , 
+ *      CONV_TUNE_PIXELS  (  
+ *    ),      
+ */
+double _time_conv(IMAGE *psf, int w1, int h1, int method) {
+	CONV_PLAN *plan; //  
+	double *in, *out; //  
+	int i; //  
+	int rows; //   
+	double start, best; //     
+
+	rows = h1;
+	if (method != CONV_FFT && (double)w1*h1 > CONV_TUNE_PIXELS) {
+		rows = CONV_TUNE_PIXELS/w1;
+		if (rows < 4*thread_count()) rows = 4*thread_count();
+		if (rows > h1) rows = h1;
+	}
+	plan = _make_conv_plan(psf, w1, rows, method);
+	in = new double[w1*rows];
+	out = new double[w1*rows];
+	for (i = 0; i < w1*rows; i++) {
+		in[i] = ((unsigned int)i*7919u%251u)/251.0;
+	}
+	best = 0;
+	for (i = 0; i < 2; i++) {
+		start = _wall_time();
+		_convplan(&in, plan, 1, &out);
+		start = _wall_time() - start;
+		if (i == 0 || start < best) {
+			best = start;
+		}
+	}
+	deleteConvPlan(plan);
+	delete [] in;
+	delete [] out;
+	return best*h1/rows;
+}
+
+/*
+ *       choice     .
+ *   conv_profile_mutex
+ */
+bool _find_conv_choice(CONV_CHOICE *choice) {
+	int i; //  
+
+	if (!conv_profile_loaded) {
+		_load_conv_profile();
+	}
+	for (i = 0; i < conv_profile_count; i++) {
+		if (conv_profile[i].w1 == choice->w1 && conv_profile[i].h1 == choice->h1
+			&& conv_profile[i].w2 == choice->w2 && conv_profile[i].h2 == choice->h2
+			&& conv_profile[i].rank == choice->rank && conv_profile[i].threads == choice->threads) {
+			choice->method = conv_profile[i].method;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ *       (w1, h1)   
+ *   .    ( , 
+ * )     ,     
+ * .       ,   
+ *      ,  
+ *    ,       
+ */
+int chooseConvMethod(IMAGE *psf, int w1, int h1) {
+	CONV_CHOICE choice; //  
+	double *row, *column; //   
+	double time, best; //  :     
+	FILE *file; //  
+	TRACE_SCOPE("tune conv");
+
+	choice.w1 = w1;
+	choice.h1 = h1;
+	choice.w2 = psf->width;
+	choice.h2 = psf->height;
+	choice.threads = parallel_busy() ? 1 : thread_count();
+	choice.rank = separatePSF(psf, SEPARABLE_TOLERANCE, &row, &column);
+	delete [] row;
+	delete [] column;
+	if (choice.rank*(choice.w2 + choice.h2) >= choice.w2*choice.h2) {
+		choice.rank = 0;
+	}
+
+	conv_profile_mutex.lock();
+	if (_find_conv_choice(&choice)) {
+		conv_profile_mutex.unlock();
+		return choice.method;
+	}
+	conv_profile_mutex.unlock();
+
+	choice.method = CONV_FFT;
+	best = _time_conv(psf, w1, h1, CONV_FFT);
+	time = _time_conv(psf, w1, h1, CONV_DIRECT);
+	if (time < best) {
+		choice.method = CONV_DIRECT;
+		best = time;
+	}
+	if (choice.rank > 0) {
+		time = _time_conv(psf, w1, h1, CONV_SEPARABLE);
+		if (time < best) {
+			choice.method = CONV_SEPARABLE;
+			best = time;
+		}
+	}
+
+	//   ,       
+	conv_profile_mutex.lock();
+	if (_find_conv_choice(&choice)) {
+		conv_profile_mutex.unlock();
+		return choice.method;
+	}
+	_add_conv_choice(&choice);
+	if (conv_profile_name != 0) {
+		file = fopen(conv_profile_name, "a");
+		if (file != 0) {
+			fprintf(file, "%d %d %d %d %d %d %d\n", choice.w1, choice.h1, choice.w2, choice.h2,
+				choice.rank, choice.threads, choice.method);
+			fclose(file);
+		}
+	}
+	conv_profile_mutex.unlock();
+	return choice.method;
+}
+
+/*
+ *     (w1, h1)    .
+ * CONV_AUTO      .
+ *   ,   
+ */
+CONV_PLAN *createConvPlan(IMAGE *psf, int w1, int h1, int method) {
+	CONV_PLAN *plan; //  
+
+	if (method != CONV_AUTO) {
+		return _make_conv_plan(psf, w1, h1, method);
+	}
+	plan = _make_conv_plan(psf, w1, h1, chooseConvMethod(psf, w1, h1));
+	plan->requested = CONV_AUTO;
+	return plan;
+}
+
+/*
+ *   ,   psf(-x, -y)
+ */
+IMAGE *mirrorPSF(IMAGE *psf) {
+	int i; //  
+	int size; //   
+	IMAGE *psf_inv; //  
+
+	size = psf->width*psf->height;
+	psf_inv = createImage(psf->width, psf->height, 1);
+	for (i = 0; i < size; i++) {
+		psf_inv->map[0][i] = psf->map[0][size - i - 1];
+	}
+	return psf_inv;
+}
+
+/*
+ *    .  ,  , 
+ *       ,    
+ *           
+ */
+WORKSPACE *createWorkspace() {
+	WORKSPACE *workspace; //   
+
+	workspace = new WORKSPACE();
+	workspace->blocks = 0;
+	workspace->origins = 0;
+	workspace->sizes = 0;
+	workspace->used = 0;
+	workspace->count = 0;
+	workspace->capacity = 0;
+	workspace->plan_count = 0;
+	workspace->plan_next = 0;
+	return workspace;
+}
+
+/*
+ *         
+ */
+void deleteWorkspace(WORKSPACE *workspace) {
+	int i; //  
+
+	if (workspace == 0) {
+		return;
+	}
+	for (i = 0; i < workspace->count; i++) {
+		free(workspace->origins[i]);
+		TRACE_FREE((double)workspace->sizes[i]);
+	}
+	for (i = 0; i < workspace->plan_count; i++) {
+		deleteConvPlan(workspace->plans[i].plan);
+		deleteConvPlan(workspace->plans[i].plan_inv);
+		deleteImage(workspace->plans[i].psf);
+		deleteImage(workspace->plans[i].psf_inv);
+	}
+	delete [] workspace->blocks;
+	delete [] workspace->origins;
+	delete [] workspace->sizes;
+	delete [] workspace->used;
+	delete workspace;
+}
+
+/*
+ *     size ,   WORKSPACE_ALIGN .
+ *     ,  , 
+ *   .  zero = false,    
+ */
+void *workspaceAlloc(WORKSPACE *workspace, size_t size, bool zero = false) {
+	int i; //  
+	int best; //    
+	void *origin; //   malloc()
+	void **blocks, **origins; //   
+	size_t *sizes; //   
+	bool *used; //   
+
+	best = -1;
+	for (i = 0; i < workspace->count; i++) {
+		if (!workspace->used[i] && workspace->sizes[i] >= size
+			&& (best < 0 || workspace->sizes[i] < workspace->sizes[best])) {
+			best = i;
+		}
+	}
+	if (best < 0) {
+		origin = malloc(size + WORKSPACE_ALIGN);
+		if (origin == 0) {
+			printf("workspaceAlloc: cannot allocate %lu bytes\n", (unsigned long)size);
+			return 0;
+		}
+		TRACE_ALLOC((double)size);
+		if (workspace->count == workspace->capacity) {
+			workspace->capacity = (workspace->capacity == 0) ? 16 : 2*workspace->capacity;
+			blocks = new void*[workspace->capacity];
+			origins = new void*[workspace->capacity];
+			sizes = new size_t[workspace->capacity];
+			used = new bool[workspace->capacity];
+			for (i = 0; i < workspace->count; i++) {
+				blocks[i] = workspace->blocks[i];
+				origins[i] = workspace->origins[i];
+				sizes[i] = workspace->sizes[i];
+				used[i] = workspace->used[i];
+			}
+			delete [] workspace->blocks;
+			delete [] workspace->origins;
+			delete [] workspace->sizes;
+			delete [] workspace->used;
+			workspace->blocks = blocks;
+			workspace->origins = origins;
+			workspace->sizes = sizes;
+			workspace->used = used;
+		}
+		best = workspace->count++;
+		workspace->origins[best] = origin;
+		workspace->blocks[best] = (void *)(((size_t)origin + WORKSPACE_ALIGN - 1)
+			/WORKSPACE_ALIGN*WORKSPACE_ALIGN);
+		workspace->sizes[best] = size;
+	}
+	workspace->used[best] = true;
+	if (zero) {
+		memset(workspace->blocks[best], 0, size);
+	}
+	return workspace->blocks[best];
+}
+
+/*
+ *     
+ */
+void workspaceRelease(WORKSPACE *workspace, void *block) {
+	int i; //  
+
+	for (i = 0; i < workspace->count; i++) {
+		if (workspace->blocks[i] == block) {
+			workspace->used[i] = false;
+			return;
+		}
+	}
+	printf("workspaceRelease: block does not belong to the workspace\n");
+}
+
+/*
+ *      ,    
+ */
+void workspaceReset(WORKSPACE *workspace) {
+	int i; //  
+
+	for (i = 0; i < workspace->count; i++) {
+		workspace->used[i] = false;
+	}
+}
+
+/*
+ *    .  releaseWorkspaceImage() 
+ * workspaceReset(),   deleteImage()
+ */
+template <class T>
+IMAGE_T<T> *createWorkspaceImage(WORKSPACE *workspace, int width, int height, int channels,
+								 bool zero = false) {
+	IMAGE_T<T> *image; //  
+	int k; //  
+
+	image = (IMAGE_T<T> *)workspaceAlloc(workspace, sizeof(IMAGE_T<T>));
+	image->width = width;
+	image->height = height;
+	image->channels = channels;
+	for (k = 0; k < channels; k++) {
+		image->map[k] = (T *)workspaceAlloc(workspace, width*height*sizeof(T), zero);
+	}
+	return image;
+}
+
+/*
+ *     
+ */
+template <class T>
+void releaseWorkspaceImage(WORKSPACE *workspace, IMAGE_T<T> *image) {
+	int k; //  
+
+	for (k = 0; k < image->channels; k++) {
+		workspaceRelease(workspace, image->map[k]);
+	}
+	workspaceRelease(workspace, image);
+}
+
+/*
+ *       
+ */
+bool _same_psf(IMAGE *psf1, IMAGE *psf2) {
+	return psf1->width == psf2->width && psf1->height == psf2->height
+		&& psf1->channels == psf2->channels
+		&& memcmp(psf1->map[0], psf2->map[0], psf1->width*psf1->height*sizeof(double)) == 0;
+}
+
+/*
+ *       ,    .
+ *    ,    :     ,
+ *        
+ */
+void workspacePlans(WORKSPACE *workspace, IMAGE *psf, int width, int height, int method,
+					OUT CONV_PLAN **plan, OUT CONV_PLAN **plan_inv) {
+	int i; //  
+	WORKSPACE_PLAN *entry; //   
+
+	for (i = 0; i < workspace->plan_count; i++) {
+		entry = &workspace->plans[i];
+		if (entry->width == width && entry->height == height
+			&& entry->method == method && _same_psf(entry->psf, psf)) {
+			*plan = entry->plan;
+			*plan_inv = entry->plan_inv;
+			return;
+		}
+	}
+	if (workspace->plan_count < WORKSPACE_PLANS) {
+		entry = &workspace->plans[workspace->plan_count++];
+	} else {
+		entry = &workspace->plans[workspace->plan_next];
+		workspace->plan_next = (workspace->plan_next + 1)%WORKSPACE_PLANS;
+		deleteConvPlan(entry->plan);
+		deleteConvPlan(entry->plan_inv);
+		deleteImage(entry->psf);
+		deleteImage(entry->psf_inv);
+	}
+	entry->psf = copyImage(psf);
+	entry->psf_inv = mirrorPSF(psf);
+	entry->width = width;
+	entry->height = height;
+	entry->method = method;
+	entry->plan = createConvPlan(entry->psf, width, height, method);
+	entry->plan_inv = createConvPlan(entry->psf_inv, width, height, method);
+	*plan = entry->plan;
+	*plan_inv = entry->plan_inv;
+}
+
+/*
+ *    
+ */
+template <class T>
+IMAGE_T<T> *conv(IMAGE_T<T> *image, IMAGE *psf, int method = CONV_AUTO) {
+	int w1, h1, w2, h2; //      
+	int channels; //   
+	double div; //  
+	IMAGE_T<T> *result; //  
+	CONV_PLAN *plan; //  
+	TRACE_SCOPE("conv");
+
+	w2 = psf->width;
+	h2 = psf->height;
+
+	if (psf->channels > 1) {
+		printf("conv: PSF should be a grayscale image\n");
+		return 0;
+	}
+	if (w2%2 != 1 || h2%2 != 1) {
+		printf("conv: PSF cannot be of a size (%d, %d)\n", w2, h2);
+		return 0;
+	}
+	channels = image->channels;
+	w1 = image->width;
+	h1 = image->height;
+
+	//   
+	div = getPSFDivisor(psf);
+	if (div == 0) {
+		return 0;
+	}
+	result = createTypedImage<T>(w1, h1, channels);
+	
+	plan = createConvPlan(psf, w1, h1, method);
+	_convplan(image->map, plan, channels, result->map);
+	deleteConvPlan(plan);
+
+	return result;
+}
+
+const char *stop_reasons[] = { "iterations", "tolerance", "stagnation", "time budget", "callback" };
+
+/*
+ *      rules
+ */
+void _start_convergence(CONVERGENCE *convergence, IN STOP_RULES *rules) {
+	convergence->rules = *rules;
+	convergence->metrics.iteration = 0;
+	convergence->metrics.residual = 0.0;
+	convergence->metrics.change = 0.0;
+	convergence->metrics.divergence = 0.0;
+	convergence->metrics.time = 0.0;
+	convergence->start = _wall_time();
+	convergence->best = -1.0;
+	convergence->best_iteration = 0;
+	convergence->reason = STOP_ITERATIONS;
+}
+
+/*
+ *    , 0   
+ */
+double _relative(double numerator, double denominator) {
+	return (denominator > 0) ? sqrt(numerator/denominator) : 0.0;
+}
+
+/*
+ *    ,    callback 
+ *   .  true,    
+ */
+bool _converged(CONVERGENCE *convergence, double residual, double change, double divergence) {
+	ITERATION_METRICS *metrics = &convergence->metrics; //  
+	STOP_RULES *rules = &convergence->rules; //  
+
+	metrics->iteration++;
+	metrics->residual = residual;
+	metrics->change = change;
+	metrics->divergence = divergence;
+	metrics->time = _wall_time() - convergence->start;
+	if (convergence->best < 0 || residual < convergence->best*(1 - STAGNATION_GAIN)) {
+		convergence->best = residual;
+		convergence->best_iteration = metrics->iteration;
+	}
+
+	if (rules->callback != 0 && !rules->callback(metrics, rules->context)) {
+		convergence->reason = STOP_CALLBACK;
+	} else if (rules->tolerance > 0 && change < rules->tolerance) {
+		convergence->reason = STOP_TOLERANCE;
+	} else if (rules->stagnation > 0 && metrics->iteration - convergence->best_iteration >= rules->stagnation) {
+		convergence->reason = STOP_STAGNATION;
+	} else if (rules->budget > 0 && metrics->time >= rules->budget) {
+		convergence->reason = STOP_TIME;
+	}
+	return convergence->reason != STOP_ITERATIONS;
+}
+
+/*
+ *   .   callback  STOP_RULES,
+ * context -   (,  )  0
+ */
+bool printMetrics(const ITERATION_METRICS *metrics, void *context) {
+	printf("%s: iteration %d, residual %g, change %g, divergence %g, %.3f s\n",
+		(context != 0) ? (const char *)context : "metrics", metrics->iteration,
+		metrics->residual, metrics->change, metrics->divergence, metrics->time);
+	return true;
+}
+
+/*
+ *    
+ */
+double _dot(IN double *u, IN double *v, int size) {
+	int i; //  
+	double sum; //  
+
+	sum = 0.0;
+	for (i = 0; i < size; i++) {
+		sum += u[i]*v[i];
+	}
+	return sum;
+}
+
+/*
+ *        
+ *  (CGLS).   :     
+ *   -       , 
+ *   O(W*H).      , 
+ *      1/tolerance .   rules
+ *         , 
+ *    
+ */
+IMAGE *deconv(IMAGE *image, IMAGE *psf, double tolerance = 1e-4, int max_iterations = 100,
+			  int method = CONV_FFT, STOP_RULES *rules = 0) {
+	int w1, h1, w2, h2; //    
+	int size1; //   
+	int channels; //    
+	int i, k, t; //  
+	int active; //  ,    
+	IMAGE *latent; //  
+	IMAGE *psf_inv; //  
+	IMAGE *r, *s, *p, *q; // ,   ,     
+	CONV_PLAN *plan, *plan_inv; //       
+	double div; //   
+	double gamma[3], gamma0[3]; //        
+	bool done[3]; //     
+	int steps[3]; //    
+	double alpha, beta, norm; //  
+	double *x, *g; //  
+	CONVERGENCE convergence; //  ,   
+	double residual[3], image_norm[3], latent_norm[3], change[3], divergence[3]; //    
+	double value; //  
+	TRACE_SCOPE("deconv");
+
+	w2 = psf->width;
+	h2 = psf->height;
+
+	if (psf->channels > 1) {
+		printf("deconv: PSF should be a grayscale image\n");
+		return 0;
+	}
+	if (w2%2 != 1 || h2%2 != 1) {
+		printf("deconv: PSF cannot be of a size (%d, %d)\n", w2, h2);
+		return 0;
+	}
+
+	channels = image->channels;
+	w1 = image->width;
+	h1 = image->height;
+	size1 = w1*h1;
+
+	//   
+	div = getPSFDivisor(psf);
+	if (div == 0) {
+		return 0;
+	}
+
+	latent = copyImage(image);
+	r = createImage(w1, h1, channels);
+	s = createImage(w1, h1, channels);
+	p = createImage(w1, h1, channels);
+	q = createImage(w1, h1, channels);
+	psf_inv = mirrorPSF(psf);
+	plan = createConvPlan(psf, w1, h1, method);
+	plan_inv = createConvPlan(psf_inv, w1, h1, method);
+
+	//   -  : r = g - Ax, s = A'r, p = s
+	_convplan(latent->map, plan, channels, q->map);
+	for (k = 0; k < 3; k++) {
+		residual[k] = 0.0;
+		image_norm[k] = 0.0;
+		divergence[k] = 0.0;
+		change[k] = 0.0;
+	}
+	for (k = 0; k < channels; k++) {
+		g = image->map[k];
+		for (i = 0; i < size1; i++) {
+			r->map[k][i] = g[i] - q->map[k][i];
+			residual[k] += r->map[k][i]*r->map[k][i];
+			image_norm[k] += g[i]*g[i];
+			divergence[k] += _divergence(g[i], q->map[k][i]);
+		}
+	}
+	for (k = 0; k < 3; k++) {
+		latent_norm[k] = image_norm[k];
+	}
+	if (rules != 0) {
+		_start_convergence(&convergence, rules);
+	}
+	_convplan(r->map, plan_inv, channels, s->map);
+	active = 0;
+	for (k = 0; k < channels; k++) {
+		for (i = 0; i < size1; i++) {
+			p->map[k][i] = s->map[k][i];
+		}
+		gamma[k] = _dot(s->map[k], s->map[k], size1);
+		gamma0[k] = gamma[k];
+		done[k] = (gamma[k] == 0);
+		steps[k] = 0;
+		if (!done[k]) active++;
+	}
+
+	for (t = 0; t < max_iterations && active > 0; t++) {
+		_convplan(p->map, plan, channels, q->map);
+		for (k = 0; k < channels; k++) {
+			change[k] = 0.0;
+			if (done[k]) continue;
+			steps[k]++;
+			norm = _dot(q->map[k], q->map[k], size1);
+			if (norm == 0) {
+				done[k] = true;
+				active--;
+				continue;
+			}
+			alpha = gamma[k]/norm;
+			x = latent->map[k];
+			g = image->map[k];
+			if (rules == 0) {
+				for (i = 0; i < size1; i++) {
+					x[i] += alpha*p->map[k][i];
+					r->map[k][i] -= alpha*q->map[k][i];
+				}
+				continue;
+			}
+			//      ,  Ax  g - r
+			residual[k] = 0.0;
+			latent_norm[k] = 0.0;
+			divergence[k] = 0.0;
+			for (i = 0; i < size1; i++) {
+				value = alpha*p->map[k][i];
+				latent_norm[k] += x[i]*x[i];
+				change[k] += value*value;
+				x[i] += value;
+				r->map[k][i] -= alpha*q->map[k][i];
+				residual[k] += r->map[k][i]*r->map[k][i];
+				divergence[k] += _divergence(g[i], g[i] - r->map[k][i]);
+			}
+		}
+		_convplan(r->map, plan_inv, channels, s->map);
+		for (k = 0; k < channels; k++) {
+			if (done[k]) continue;
+			norm = _dot(s->map[k], s->map[k], size1);
+			beta = norm/gamma[k];
+			gamma[k] = norm;
+			for (i = 0; i < size1; i++) {
+				p->map[k][i] = s->map[k][i] + beta*p->map[k][i];
+			}
+			if (sqrt(norm/gamma0[k]) < tolerance) {
+				done[k] = true;
+				active--;
+			}
+		}
+		if (rules != 0 && _converged(&convergence,
+			_relative(residual[0] + residual[1] + residual[2], image_norm[0] + image_norm[1] + image_norm[2]),
+			_relative(change[0] + change[1] + change[2], latent_norm[0] + latent_norm[1] + latent_norm[2]),
+			(divergence[0] + divergence[1] + divergence[2])/(channels*size1))) {
+			printf("deconv: stopped by %s after %d iterations\n", stop_reasons[convergence.reason], t + 1);
+			break;
+		}
+	}
+	for (k = 0; k < channels; k++) {
+		printf("deconv: color channel %d, %d iterations, relative residual %g\n",
+			k, steps[k], gamma0[k] > 0 ? sqrt(gamma[k]/gamma0[k]) : 0.0);
+	}
+
+	deleteImage(r);
+	deleteImage(s);
+	deleteImage(p);
+	deleteImage(q);
+	deleteConvPlan(plan);
+	deleteConvPlan(plan_inv);
+	deleteImage(psf_inv);
+	return latent;
+}
+
+/*
+ *  
+ */
+void deleteBandedLU(BANDED_LU *lu) {
+	if (lu == 0) {
+		return;
+	}
+	delete [] lu->u;
+	delete [] lu->l;
+	delete [] lu->pivot;
+	delete lu;
+}
+
+/*
+ *   j   j + 1 + begin ... j + end
+ */
+void _eliminate_range(void *context, int begin, int end) {
+	ELIMINATE_TASK *task = (ELIMINATE_TASK *)context;
+	BANDED_LU *lu = task->lu;
+	int n, i, c; //  
+	int j; //  
+	int kl, row; //  
+	double m; //  
+	double *pivot_row, *current; //    
+
+	j = task->j;
+	kl = lu->kl;
+	row = lu->row;
+	pivot_row = lu->u + j*row + kl - j; // pivot_row[c] -   c
+	for (n = begin; n < end; n++) {
+		i = j + 1 + n;
+		current = lu->u + i*row + kl - i;
+		m = current[j]/pivot_row[j];
+		lu->l[j*kl + n] = m;
+		current[j] = 0;
+		if (m == 0) continue;
+		for (c = j + 1; c <= task->last; c++) {
+			current[c] -= m*pivot_row[c];
+		}
+	}
+}
+
+/*
+ *      (w1, h1)     
+ *   LU      .    
+ * ,         
+ *  .      : 
+ *  ,   conv(),    .
+ *   BANDED_LU_MEMORY   
+ */
+BANDED_LU *createBandedLU(IMAGE *psf, int w1, int h1) {
+	BANDED_LU *lu; //  
+	ELIMINATE_TASK task; //    
+	int w2, h2; //  
+	int a, b; //    
+	int step_x, step_y; //        
+	int n, kl, row; //  
+	int x, y, i, j, c, p; //  
+	int xx, yy; //    
+	int lower; //       
+	double *h; //   
+	double *r, *pivot_row, *other; //  
+	double div; //  
+	double value, temp; //  
+
+	w2 = psf->width;
+	h2 = psf->height;
+	if (psf->channels > 1) {
+		printf("createBandedLU: PSF should be a grayscale image\n");
+		return 0;
+	}
+	if (w2%2 != 1 || h2%2 != 1) {
+		printf("createBandedLU: PSF cannot be of a size (%d, %d)\n", w2, h2);
+		return 0;
+	}
+	div = getPSFDivisor(psf);
+	if (div == 0) {
+		return 0;
+	}
+	a = w2/2;
+	b = h2/2;
+	h = psf->map[0];
+	n = w1*h1;
+	//   a*step_x + b*step_y,   ,    
+	kl = (a*h1 + b < a + b*w1) ? a*h1 + b : a + b*w1;
+	row = 3*kl + 1;
+	//  n*row ,     int
+	if ((double)n*row > 2147483647.0) {
+		printf("createBandedLU: image (%d, %d) is too large for the direct solver\n", w1, h1);
+		return 0;
+	}
+	//   n*(row + kl) ,      :
+	//        deconv()
+	if ((double)n*(row + kl)*sizeof(double) + (double)n*sizeof(int) > BANDED_LU_MEMORY) {
+		printf("createBandedLU: image (%d, %d) with PSF (%d, %d) needs %.0f MB, use deconv() instead\n",
+			w1, h1, w2, h2, ((double)n*(row + kl)*sizeof(double) + (double)n*sizeof(int))/1048576.0);
+		return 0;
+	}
+
+	lu = new BANDED_LU();
+	lu->width = w1;
+	lu->height = h1;
+	lu->transposed = (a*h1 + b < a + b*w1);
+	step_x = lu->transposed ? h1 : 1;
+	step_y = lu->transposed ? 1 : w1;
+	lu->size = n;
+	lu->kl = kl;
+	lu->ku = kl;
+	lu->row = row;
+	lu->u = new double[n*row];
+	lu->l = new double[n*kl + 1];
+	lu->pivot = new int[n];
+	for (i = 0; i < n*row; i++) {
+		lu->u[i] = 0.0;
+	}
+
+	//   (x, y)      
+	for (x = 0; x < w1; x++) {
+		for (y = 0; y < h1; y++) {
+			i = x*step_x + y*step_y;
+			r = lu->u + i*row + kl - i;
+			for (p = 0; p < w2; p++) {
+				for (j = 0; j < h2; j++) {
+					xx = x + p - a;
+					yy = y + j - b;
+					if (xx < 0 || xx >= w1 || yy < 0 || yy >= h1) continue;
+					r[xx*step_x + yy*step_y] += h[(h2 - j)*w2 - p - 1]/div;
+				}
+			}
+		}
+	}
+
+	task.lu = lu;
+	for (j = 0; j < n; j++) {
+		//     kl   
+		lower = (j + kl < n) ? kl : n - 1 - j;
+		p = j;
+		value = fabs(lu->u[j*row + kl]);
+		for (i = j + 1; i <= j + lower; i++) {
+			if (fabs(lu->u[i*row + kl - i + j]) > value) {
+				value = fabs(lu->u[i*row + kl - i + j]);
+				p = i;
+			}
+		}
+		lu->pivot[j] = p;
+		if (value == 0) {
+			printf("createBandedLU: matrix is singular\n");
+			deleteBandedLU(lu);
+			return 0;
+		}
+		task.last = (j + 2*kl < n) ? j + 2*kl : n - 1;
+		if (p != j) {
+			pivot_row = lu->u + j*row + kl - j;
+			other = lu->u + p*row + kl - p;
+			for (c = j; c <= task.last; c++) {
+				temp = pivot_row[c];
+				pivot_row[c] = other[c];
+				other[c] = temp;
+			}
+		}
+		task.j = j;
+		parallel_for(lower, _eliminate_range, &task);
+	}
+	return lu;
+}
+
+struct BANDED_TASK {
+	BANDED_LU *lu; // 
+	double **in_maps, **out_maps; //    
+	double **buf; //   
+};
+
+/*
+ *    begin ... end - 1
+ */
+void _banded_solve_range(void *context, int begin, int end) {
+	BANDED_TASK *task = (BANDED_TASK *)context;
+	BANDED_LU *lu = task->lu;
+	int k, i, j, c, x, y; //  
+	int n, kl, row, last; //  
+	int step_x, step_y; //    
+	double *v, *r; //     U
+	double sum, temp; //  
+
+	n = lu->size;
+	kl = lu->kl;
+	row = lu->row;
+	step_x = lu->transposed ? lu->height : 1;
+	step_y = lu->transposed ? 1 : lu->width;
+	for (k = begin; k < end; k++) {
+		v = task->buf[k];
+		for (y = 0; y < lu->height; y++) {
+			for (x = 0; x < lu->width; x++) {
+				v[x*step_x + y*step_y] = task->in_maps[k][y*lu->width + x];
+			}
+		}
+		//      ,    
+		for (j = 0; j < n; j++) {
+			if (lu->pivot[j] != j) {
+				temp = v[j];
+				v[j] = v[lu->pivot[j]];
+				v[lu->pivot[j]] = temp;
+			}
+			last = (j + kl < n) ? j + kl : n - 1;
+			for (i = j + 1; i <= last; i++) {
+				v[i] -= lu->l[j*kl + i - j - 1]*v[j];
+			}
+		}
+		//  
+		for (j = n - 1; j >= 0; j--) {
+			r = lu->u + j*row + kl - j;
+			last = (j + 2*kl < n) ? j + 2*kl : n - 1;
+			sum = v[j];
+			for (c = j + 1; c <= last; c++) {
+				sum -= r[c]*v[c];
+			}
+			v[j] = sum/r[j];
+		}
+		for (y = 0; y < lu->height; y++) {
+			for (x = 0; x < lu->width; x++) {
+				task->out_maps[k][y*lu->width + x] = v[x*step_x + y*step_y];
+			}
+		}
+	}
+}
+
+/*
+ *       LU.   lu 
+ * ,     ;   
+ *   ,     createBandedLU()
+ */
+IMAGE *deconvbanded(IMAGE *image, IMAGE *psf, BANDED_LU *lu = 0) {
+	int k; //  
+	int channels; //   
+	bool own; //   
+	IMAGE *latent; //  
+	BANDED_TASK task; //    
+	double *buf[3]; //   
+	TRACE_SCOPE("deconvbanded");
+
+	own = (lu == 0);
+	if (own) {
+		lu = createBandedLU(psf, image->width, image->height);
+		if (lu == 0) {
+			return 0;
+		}
+	} else if (lu->width != image->width || lu->height != image->height) {
+		printf("deconvbanded: factorization is for a size (%d, %d)\n", lu->width, lu->height);
+		return 0;
+	}
+
+	channels = image->channels;
+	latent = createImage(image->width, image->height, channels);
+	for (k = 0; k < channels; k++) {
+		buf[k] = new double[lu->size];
+	}
+	task.lu = lu;
+	task.in_maps = image->map;
+	task.out_maps = latent->map;
+	task.buf = buf;
+	parallel_for(channels, _banded_solve_range, &task);
+
+	for (k = 0; k < channels; k++) {
+		delete [] buf[k];
+	}
+	if (own) {
+		deleteBandedLU(lu);
+	}
+	return latent;
+}
+
+/*
+ *   
+ */
+FOURIER_IMAGE *_FT(IMAGE *image) {
+	FOURIER_IMAGE *fourier_image; //    -
+	comp *comp_map; //   
+	double *map; //   
+	double real, imag, value; //    
+	int index1, index2; //     
+	int w, h; //  
+	int size; //    
+	int sign; // 1  -1    (-1)^(x+y)  
+	int channels; //   
+	int x, y, u, v, k; //  
+	TRACE_SCOPE("_FT");
+
+	w = image->width;
+	h = image->height;
+	size = w*h;
+	channels = image->channels;
+	fourier_image = new FOURIER_IMAGE();
+	fourier_image->channels = channels;
+	fourier_image->width = w;
+	fourier_image->height = h;
+
+	for (k = 0; k < channels; k++) {
+		map = image->map[k];
+		comp_map = new comp[size];
+
+		for (u = 0; u < w; u++) {
+			for (v = 0; v < h; v++) {
+				index2 = v*w + u;
+				real = 0;
+				imag = 0;
+				for (x = 0; x < w; x++) {
+					for (y = 0; y < h; y++) {
+						index1 = y*w + x;
+						sign = 1 - 2*((x+y)%2); //     (-1)^(x+y)
+						real += sign*map[index1]*cos(2*PI*(u*x/w+v*y/h)*(PI/180));
+						imag += -sign*map[index1]*cos(2*PI*(u*x/w+v*y/h)*(PI/180));
+					}
+				}
+				comp_map[index2].real(real/size);
+				comp_map[index2].imag(imag/size);
+			}
+		}
+		fourier_image->map[k] = comp_map;
+	}
+
+	return fourier_image;
+}
+
+/*
+ *   
+ */
+IMAGE *_IFT(FOURIER_IMAGE *fourier_image) {
+	IMAGE *image; // 
+	comp *comp_map; //   
+	comp value; //    
+	double *map; //   
+	double real;  //    
+	int index1, index2; //     
+	int w, h; //  
+	int size; //    
+	int sign; // 1  -1    (-1)^(x+y)  
+	int channels; //   
+	int x, y, u, v, k; //  
+	TRACE_SCOPE("_IFT");
+
+	w = fourier_image->width;
+	h = fourier_image->height;
+	size = w*h;
+	channels = fourier_image->channels;
+	image = new IMAGE();
+	image->channels = channels;
+	image->width = w;
+	image->height = h;
+
+	for (k = 0; k < channels; k++) {
+		comp_map = fourier_image->map[k];
+		map = new double[size];
+
+		for (x = 0; x < w; x++) {
+			for (y = 0; y < h; y++) {
+				index1 = y*w + x;
+				real = 0;
+				for (u = 0; u < w; u++) {
+					for (v = 0; v < h; v++) {
+						index2 = v*w + u;
+						value.real(cos(2*PI*(u*x/w+v*y/h)*(PI/180)));
+						value.imag(sin(2*PI*(u*x/w+v*y/h)*(PI/180)));
+						real += (comp_map[index2]*value).real();
+					}
+				}
+				sign = 1 - 2*((x+y)%2); //     (-1)^(x+y)
+				map[index1] = sign*real;
+			}
+		}
+		image->map[k] = map;
+	}
+	TRACE_ALLOC((double)channels*size*sizeof(double));
+
+	return image;
+}
+
+/*
+ *   begin ... end - 1     
+ */
+void _inverse_filter_range(void *context, int begin, int end) {
+	SPECTRUM_TASK<double> *task = (SPECTRUM_TASK<double> *)context;
+	int i; //  
+	comp value; //   
+
+	for (i = begin; i < end; i++) {
+		value = task->kernel->spectrum[i];
+		if (value.imag() != 0 || value.real() != 0) {
+			task->kernel->buf[i] *= task->div/value;
+		}
+	}
+}
+
+/*
+ *  
+ */
+IMAGE *deconvinverse(IMAGE *image, IMAGE *psf) {
+	int w2, h2; //  
+	int channels; //    
+	int k; //  
+	IMAGE *latent; //  
+	FFT_KERNEL *kernel; //  
+	SPECTRUM_TASK<double> task; //     
+	double div; //   
+	TRACE_SCOPE("deconvinverse");
+
+	w2 = psf->width;
+	h2 = psf->height;
+
+	if (psf->channels > 1) {
+		printf("deconvinverse: PSF should be a grayscale image\n");
+		return 0;
+	}
+	if (w2%2 != 1 || h2%2 != 1) {
+		printf("deconvinverse: PSF cannot be of a size (%d, %d)\n", w2, h2);
+		return 0;
+	}
+
+	channels = image->channels;
+
+	//   
+	div = getPSFDivisor(psf);
+	if (div == 0) {
+		return 0;
+	}
+
+	latent = createImage(image->width, image->height, channels);
+	kernel = createFFTKernel(psf, image->width, image->height);
+	task.kernel = kernel;
+	task.f = 0;
+	task.div = div;
+
+	for (k = 0; k < channels; k++) {
+		_image_spectrum(image->map[k], kernel);
+		parallel_for(kernel->spectrum_size, _inverse_filter_range, &task);
+		_spectrum_image(kernel, 1.0, latent->map[k]);
+	}
+	deleteFFTKernel(kernel);
+
+	return latent;
+}
+
+struct WIENER_TASK {
+	FFT_KERNEL *kernel; //     
+	comp *image_spectrum; //    
+	double *penalty; //   |L|^2
+	double weight; //  
+};
+
+/*
+ *  -   begin ... end - 1
+ */
+void _wiener_filter_range(void *context, int begin, int end) {
+	WIENER_TASK *task = (WIENER_TASK *)context;
+	FFT_KERNEL *kernel = task->kernel;
+	int i; //  
+	double div; //  
+	double denominator; // |H|^2 + weight*|L|^2
+	comp value; //   
+
+	div = kernel->div;
+	for (i = begin; i < end; i++) {
+		value = kernel->spectrum[i]/div;
+		denominator = norm(value) + task->weight*task->penalty[i];
+		if (denominator != 0) {
+			kernel->buf[i] = task->image_spectrum[i]*conj(value)/denominator;
+		} else {
+			kernel->buf[i] = 0;
+		}
+	}
+}
+
+/*
+ *  -    :  f,
+ *  |h*f - g|^2 + weight*|Lf|^2,  L -  
+ * (REG_IDENTITY)   (REG_LAPLACE).    
+ *   ,         
+ * .  results[i]    weights[i]
+ */
+void deconvwienersweep(IMAGE *image, IMAGE *psf, IN double *weights, int count,
+					   int regularizer, OUT IMAGE **results) {
+	int w2, h2; //  
+	int fw, fh; //   
+	int half; //      
+	int channels; //    
+	int k, i, u, v; //  
+	FFT_KERNEL *kernel; //  
+	WIENER_TASK task; //    
+	comp *spectra[3]; //    
+	double *penalty; //  
+	double lu, lv; //     
+	TRACE_SCOPE("deconvwiener");
+
+	for (i = 0; i < count; i++) {
+		results[i] = 0;
+	}
+	w2 = psf->width;
+	h2 = psf->height;
+	if (psf->channels > 1) {
+		printf("deconvwiener: PSF should be a grayscale image\n");
+		return;
+	}
+	if (w2%2 != 1 || h2%2 != 1) {
+		printf("deconvwiener: PSF cannot be of a size (%d, %d)\n", w2, h2);
+		return;
+	}
+	if (getPSFDivisor(psf) == 0) {
+		return;
+	}
+
+	channels = image->channels;
+	kernel = createFFTKernel(psf, image->width, image->height);
+	fw = kernel->fft_width;
+	fh = kernel->fft_height;
+	half = fw/2 + 1;
+
+	//   4 - 2cos(2pi*u/fw) - 2cos(2pi*v/fh)  
+	penalty = new double[kernel->spectrum_size];
+	for (v = 0; v < fh; v++) {
+		lv = 2 - 2*cos(2*PI*v/fh);
+		for (u = 0; u < half; u++) {
+			lu = 2 - 2*cos(2*PI*u/fw);
+			penalty[v*half + u] = (regularizer == REG_LAPLACE) ? (lu + lv)*(lu + lv) : 1.0;
+		}
+	}
+
+	for (k = 0; k < channels; k++) {
+		_image_spectrum(image->map[k], kernel);
+		spectra[k] = new comp[kernel->spectrum_size];
+		for (i = 0; i < kernel->spectrum_size; i++) {
+			spectra[k][i] = kernel->buf[i];
+		}
+	}
+
+	task.kernel = kernel;
+	task.penalty = penalty;
+	for (i = 0; i < count; i++) {
+		results[i] = createImage(image->width, image->height, channels);
+		task.weight = weights[i];
+		for (k = 0; k < channels; k++) {
+			task.image_spectrum = spectra[k];
+			parallel_for(kernel->spectrum_size, _wiener_filter_range, &task);
+			_spectrum_image(kernel, 1.0, results[i]->map[k]);
+		}
+	}
+
+	for (k = 0; k < channels; k++) {
+		delete [] spectra[k];
+	}
+	delete [] penalty;
+	deleteFFTKernel(kernel);
+}
+
+/*
+ *  -    
+ */
+IMAGE *deconvwiener(IMAGE *image, IMAGE *psf, double weight, int regularizer = REG_IDENTITY) {
+	IMAGE *result; //  
+
+	deconvwienersweep(image, psf, &weight, 1, regularizer, &result);
+	return result;
+}
+
+/*
+ *  -    .   latent,
+ *   ,    .   
+ * ,     latent   . 
+ * convergence       ,  
+ *    
+ */
+template <class T>
+IMAGE_T<T> *_lucy(IMAGE_T<T> *image, CONV_PLAN *plan, CONV_PLAN *plan_inv, int iterations, bool progress,
+				  IMAGE_T<T> *latent = 0, WORKSPACE *workspace = 0, CONVERGENCE *convergence = 0) {
+	int w1, h1; //  
+	int channels; //    
+	int k; //  
+	IMAGE_T<T> *temp1, *temp2; //     
+	double *rows; //     
+	double residual, norm, divergence; //   
+
+	channels = image->channels;
+	w1 = image->width;
+	h1 = image->height;
+	if (workspace != 0) {
+		if (latent == 0) {
+			latent = createWorkspaceImage<T>(workspace, w1, h1, channels);
+			for (k = 0; k < channels; k++) {
+				memcpy(latent->map[k], image->map[k], w1*h1*sizeof(T));
+			}
+		}
+		temp1 = createWorkspaceImage<T>(workspace, w1, h1, channels);
+		temp2 = createWorkspaceImage<T>(workspace, w1, h1, channels);
+	} else {
+		if (latent == 0) {
+			latent = copyImage(image);
+		}
+		temp1 = createTypedImage<T>(w1, h1, channels, false);
+		temp2 = createTypedImage<T>(w1, h1, channels, false);
+	}
+	rows = 0;
+	if (convergence != 0) {
+		rows = (workspace != 0) ? (double *)workspaceAlloc(workspace, 3*channels*h1*sizeof(double))
+			: new double[3*channels*h1];
+	}
+	residual = 0.0;
+	norm = 0.0;
+	divergence = 0.0;
+
+	//   callback,    
+	if (convergence != 0 && convergence->rules.callback != 0) {
+		progress = false;
+	}
+	for (k = 0; k < iterations; k++) {
+		TRACE_SCOPE("lucy iteration");
+		if (progress) printf("*%d", k);
+		_convplan(latent->map, plan, channels, temp1->map);
+		_divide_maps(image->map, temp1->map, channels, w1, h1, rows);
+		if (convergence != 0) {
+			residual = _sum_rows(rows, channels*h1, 0);
+			norm = _sum_rows(rows, channels*h1, 1);
+			divergence = _sum_rows(rows, channels*h1, 2);
+		}
+		_convplan(temp1->map, plan_inv, channels, temp2->map);
+		_multiply_maps(latent->map, temp2->map, channels, w1, h1, rows);
+		if (convergence != 0 && _converged(convergence, _relative(residual, norm),
+			_relative(_sum_rows(rows, channels*h1, 0), _sum_rows(rows, channels*h1, 1)),
+			divergence/(channels*w1*h1))) {
+			break;
+		}
+	}
+	if (progress) printf("\n");
+	if (workspace != 0) {
+		if (rows != 0) workspaceRelease(workspace, rows);
+		releaseWorkspaceImage(workspace, temp1);
+		releaseWorkspaceImage(workspace, temp2);
+	} else {
+		delete [] rows;
+		deleteImage(temp1);
+		deleteImage(temp2);
+	}
+	return latent;
+}
+
+/*
+ *  -.        
+ *    releaseWorkspaceImage()  workspaceReset(). 
+ *  rules iterations -   
+ */
+template <class T>
+IMAGE_T<T> *deconvlucy(IMAGE_T<T> *image, IMAGE *psf, int iterations, int method = CONV_AUTO,
+					   WORKSPACE *workspace = 0, STOP_RULES *rules = 0) {
+	int w1, h1, w2, h2; //    
+	IMAGE_T<T> *latent; //  
+	IMAGE *psf_inv; //  ,   psf(-x, -y)
+	CONV_PLAN *plan, *plan_inv; //       
+	double div; //   
+	CONVERGENCE convergence; //  
+	TRACE_SCOPE("deconvlucy");
+
+	w2 = psf->width;
+	h2 = psf->height;
+
+	if (psf->channels > 1) {
+		printf("deconvlucy: PSF should be a grayscale image\n");
+		return 0;
+	}
+	if (w2%2 != 1 || h2%2 != 1) {
+		printf("deconvlucy: PSF cannot be of a size (%d, %d)\n", w2, h2);
+		return 0;
+	}
+
+	w1 = image->width;
+	h1 = image->height;
+
+	//   
+	div = getPSFDivisor(psf);
+	if (div == 0) {
+		return 0;
+	}
+
+	if (rules != 0) {
+		_start_convergence(&convergence, rules);
+	}
+
+	//        
+	if (workspace != 0) {
+		workspacePlans(workspace, psf, w1, h1, method, &plan, &plan_inv);
+		latent = _lucy(image, plan, plan_inv, iterations, true, (IMAGE_T<T> *)0, workspace,
+			(rules != 0) ? &convergence : 0);
+	} else {
+		psf_inv = mirrorPSF(psf);
+
+		//        
+		plan = createConvPlan(psf, w1, h1, method);
+		plan_inv = createConvPlan(psf_inv, w1, h1, method);
+
+		latent = _lucy(image, plan, plan_inv, iterations, true, (IMAGE_T<T> *)0, (WORKSPACE *)0,
+			(rules != 0) ? &convergence : 0);
+
+		deleteConvPlan(plan);
+		deleteConvPlan(plan_inv);
+		deleteImage(psf_inv);
+	}
+	if (rules != 0 && convergence.reason != STOP_ITERATIONS) {
+		printf("deconvlucy: stopped by %s after %d iterations\n", stop_reasons[convergence.reason],
+			convergence.metrics.iteration);
+	}
+	return latent;
+}
+
+/*
+ *   FNV-1a  size  data
+ */
+unsigned int _fnv_hash(const void *data, size_t size, unsigned int hash) {
+	const unsigned char *bytes = (const unsigned char *)data; //  
+	size_t i; //  
+
+	for (i = 0; i < size; i++) {
+		hash = (hash ^ bytes[i])*16777619u;
+	}
+	return hash;
+}
+
+/*
+ *  ,    .  , 
+ *   ,  ,    
+ */
+template <class T>
+unsigned int _sweep_fingerprint(IMAGE_T<T> *image, IMAGE *psf, int method) {
+	int sizes[7]; // ,     
+	unsigned int hash; // 
+	int k; //  
+
+	sizes[0] = image->width;
+	sizes[1] = image->height;
+	sizes[2] = image->channels;
+	sizes[3] = sizeof(T);
+	sizes[4] = psf->width;
+	sizes[5] = psf->height;
+	sizes[6] = method;
+	hash = _fnv_hash(sizes, sizeof(sizes), 2166136261u);
+	for (k = 0; k < image->channels; k++) {
+		hash = _fnv_hash(image->map[k], (size_t)image->width*image->height*sizeof(T), hash);
+	}
+	return _fnv_hash(psf->map[0], (size_t)psf->width*psf->height*sizeof(double), hash);
+}
+
+/*
+ *      :   
+ * ,     ,    
+ * ,          
+ */
+template <class T>
+void _save_checkpoint(IMAGE_T<T> *latent, const std::string &name, int iteration, unsigned int fingerprint) {
+	std::string temp; //  
+	RAW_FILE *file; //  ,   
+	bool saved; //   
+	TRACE_SCOPE("checkpoint");
+
+	temp = name + ".tmp";
+	file = _write_raw_file(latent, temp.c_str(), iteration);
+	if (file == 0) {
+		printf("deconvlucysweep: cannot write checkpoint %s\n", name.c_str());
+		return;
+	}
+	file->header->fingerprint = fingerprint;
+	saved = flushRawFile(file);
+	closeRawFile(file);
+	if (saved) {
+#ifdef _WIN32
+		saved = MoveFileExA(temp.c_str(), name.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+		saved = rename(temp.c_str(), name.c_str()) == 0;
+#endif
+	}
+	if (!saved) {
+		printf("deconvlucysweep: cannot write checkpoint %s\n", name.c_str());
+		remove(temp.c_str());
+	}
+}
+
+/*
+ *    iteration     
+ */
+std::string _snapshot_name(const char *checkpoint, int iteration) {
+	char number[16]; //  
+
+	sprintf(number, ".%d", iteration);
+	return std::string(checkpoint) + number;
+}
+
+/*
+ *  -  :      
+ * iterations[0 ... count - 1]  results[i]   
+ * iterations[i] .    checkpoint,  LUCY_CHECKPOINT
+ *      ,   -  
+ * checkpoint.<>.        
+ *   ,       ,
+ *    .     .
+ *     rules,   
+ *  
+ */
+template <class T>
+void deconvlucysweep(IMAGE_T<T> *image, IMAGE *psf, IN int *iterations, int count,
+					 OUT IMAGE_T<T> **results, const char *checkpoint = 0, int method = CONV_AUTO,
+					 STOP_RULES *rules = 0) {
+	int w1, h1, w2, h2; //    
+	IMAGE_T<T> *latent; //  
+	IMAGE *psf_inv; //  ,   psf(-x, -y)
+	CONV_PLAN *plan, *plan_inv; //       
+	int done; //  
+	int last; //  
+	int next; //      
+	int i; //  
+	FILE *file; // ,    
+	CONVERGENCE convergence; //  
+	unsigned int fingerprint; //  ,    
+	unsigned int stored; //   
+	int tag; //     
+	TRACE_SCOPE("deconvlucysweep");
+
+	for (i = 0; i < count; i++) {
+		results[i] = 0;
+	}
+	w2 = psf->width;
+	h2 = psf->height;
+	if (psf->channels > 1) {
+		printf("deconvlucysweep: PSF should be a grayscale image\n");
+		return;
+	}
+	if (w2%2 != 1 || h2%2 != 1) {
+		printf("deconvlucysweep: PSF cannot be of a size (%d, %d)\n", w2, h2);
+		return;
+	}
+	if (getPSFDivisor(psf) == 0) {
+		return;
+	}
+	w1 = image->width;
+	h1 = image->height;
+	last = 0;
+	for (i = 0; i < count; i++) {
+		if (iterations[i] > last) {
+			last = iterations[i];
+		}
+	}
+
+	//    ,       
+	latent = 0;
+	done = 0;
+	fingerprint = (checkpoint != 0) ? _sweep_fingerprint(image, psf, method) : 0;
+	file = (checkpoint != 0) ? fopen(checkpoint, "rb") : 0;
+	if (file != 0) {
+		fclose(file);
+		latent = loadRawImage<T>(checkpoint, &done, &stored);
+		if (latent != 0 && (stored != fingerprint || latent->width != w1 || latent->height != h1
+			|| latent->channels != image->channels || done < 0 || done > last)) {
+			printf("deconvlucysweep: checkpoint %s does not match the image, PSF or method\n", checkpoint);
+			deleteImage(latent);
+			latent = 0;
+			done = 0;
+		}
+		if (latent != 0) {
+			printf("deconvlucysweep: resuming from iteration %d\n", done);
+			for (i = 0; i < count; i++) {
+				if (iterations[i] > 0 && iterations[i] <= done) {
+					results[i] = loadRawImage<T>(_snapshot_name(checkpoint, iterations[i]).c_str(), &tag, &stored);
+					if (results[i] != 0 && (stored != fingerprint || tag != iterations[i])) {
+						deleteImage(results[i]);
+						results[i] = 0;
+					}
+					if (results[i] == 0) {
+						printf("deconvlucysweep: snapshot after %d iterations is lost\n", iterations[i]);
+					}
+				}
+			}
+		}
+	}
+	if (latent == 0) {
+		latent = copyImage(image);
+	}
+	for (i = 0; i < count; i++) {
+		if (iterations[i] <= 0 && results[i] == 0) {
+			results[i] = copyImage(image);
+		}
+	}
+
+	psf_inv = mirrorPSF(psf);
+	plan = createConvPlan(psf, w1, h1, method);
+	plan_inv = createConvPlan(psf_inv, w1, h1, method);
+	if (rules != 0) {
+		_start_convergence(&convergence, rules);
+		convergence.metrics.iteration = done;
+	}
+
+	while (done < last) {
+		next = last;
+		for (i = 0; i < count; i++) {
+			if (iterations[i] > done && iterations[i] < next) {
+				next = iterations[i];
+			}
+		}
+		if (checkpoint != 0 && (done/LUCY_CHECKPOINT + 1)*LUCY_CHECKPOINT < next) {
+			next = (done/LUCY_CHECKPOINT + 1)*LUCY_CHECKPOINT;
+		}
+		_lucy(image, plan, plan_inv, next - done, true, latent, (WORKSPACE *)0,
+			(rules != 0) ? &convergence : 0);
+		if (rules != 0 && convergence.reason != STOP_ITERATIONS) {
+			printf("deconvlucysweep: stopped by %s after %d iterations\n", stop_reasons[convergence.reason],
+				convergence.metrics.iteration);
+			done = last;
+			for (i = 0; i < count; i++) {
+				if (results[i] == 0) {
+					results[i] = copyImage(latent);
+				}
+			}
+			break;
+		}
+		done = next;
+
+		for (i = 0; i < count; i++) {
+			if (iterations[i] == done && results[i] == 0) {
+				results[i] = copyImage(latent);
+				if (checkpoint != 0 && done < last) {
+					_save_checkpoint(results[i], _snapshot_name(checkpoint, done), done, fingerprint);
+				}
+			}
+		}
+		if (checkpoint != 0 && done < last) {
+			_save_checkpoint(latent, checkpoint, done, fingerprint);
+		}
+	}
+
+	//  ,     
+	if (checkpoint != 0) {
+		remove(checkpoint);
+		for (i = 0; i < count; i++) {
+			remove(_snapshot_name(checkpoint, iterations[i]).c_str());
+		}
+	}
+	deleteConvPlan(plan);
+	deleteConvPlan(plan_inv);
+	deleteImage(psf_inv);
+	deleteImage(latent);
+}
+
+template <class T>
+struct ACCEL_TASK {
+	T **latent, **prev; //    
+	T **predicted; //  ,   
+	T **step; //  
+	T **result; //   -
+	int width; //    
+	int height; //    
+	double alpha; //  
+	double *rows; //     : (, step), (step, step),     
+};
+
+/*
+ *   begin ... end - 1  , 
+ *  
+ */
+template <class T>
+void _extrapolate_range(void *context, int begin, int end) {
+	ACCEL_TASK<T> *task = (ACCEL_TASK<T> *)context;
+	int n, i; //  
+	int offset; //     
+	T *latent, *prev, *predicted; //   
+	double value; //  
+
+	for (n = begin; n < end; n++) {
+		offset = (n%task->height)*task->width;
+		latent = task->latent[n/task->height] + offset;
+		prev = task->prev[n/task->height] + offset;
+		predicted = task->predicted[n/task->height] + offset;
+		for (i = 0; i < task->width; i++) {
+			value = latent[i] + task->alpha*(latent[i] - prev[i]);
+			predicted[i] = (T)((value > 0) ? value : 0.0);
+		}
+	}
+}
+
+/*
+ *     begin ... end - 1  : predicted
+ *   result - predicted,   rows    
+ *     
+ */
+template <class T>
+void _accel_step_range(void *context, int begin, int end) {
+	ACCEL_TASK<T> *task = (ACCEL_TASK<T> *)context;
+	int n, i; //  
+	int offset; //     
+	T *latent, *predicted, *step, *result; //   
+	double value; //  
+	double product, step_norm, change, norm; //   
+
+	for (n = begin; n < end; n++) {
+		offset = (n%task->height)*task->width;
+		latent = task->latent[n/task->height] + offset;
+		predicted = task->predicted[n/task->height] + offset;
+		step = task->step[n/task->height] + offset;
+		result = task->result[n/task->height] + offset;
+		product = 0.0;
+		step_norm = 0.0;
+		change = 0.0;
+		norm = 0.0;
+		for (i = 0; i < task->width; i++) {
+			value = result[i] - predicted[i];
+			predicted[i] = (T)value;
+			product += value*step[i];
+			step_norm += (double)step[i]*step[i];
+			value = result[i] - latent[i];
+			change += value*value;
+			norm += (double)latent[i]*latent[i];
+		}
+		task->rows[4*n] = product;
+		task->rows[4*n + 1] = step_norm;
+		task->rows[4*n + 2] = change;
+		task->rows[4*n + 3] = norm;
+	}
+}
+
+/*
+ *   - (Biggs, Andrews).   
+ * -     
+ * : y = x + alpha*(x - x_prev),  alpha    
+ * .  ,    latent
+ *   threshold,  iterations     rules
+ */
+template <class T>
+IMAGE_T<T> *deconvlucyaccel(IMAGE_T<T> *image, IMAGE *psf, int iterations, double threshold = 1e-4,
+							int method = CONV_FFT, STOP_RULES *rules = 0) {
+	int w1, h1, w2, h2; //    
+	int size1; //   
+	int channels; //    
+	int t; //  
+	IMAGE_T<T> *latent, *prev; //    
+	IMAGE_T<T> *predicted; //  ,   
+	IMAGE_T<T> *step; //  
+	IMAGE *psf_inv; //  
+	IMAGE_T<T> *temp1, *temp2; //     
+	IMAGE_T<T> *swap; //   
+	CONV_PLAN *plan, *plan_inv; //       
+	double div; //   
+	double alpha; //  
+	double product, step_norm; //   
+	double change, norm; //     
+	CONVERGENCE convergence; //  
+	double *rows; //    
+	ACCEL_TASK<T> task; //      
+	bool progress; //    
+	TRACE_SCOPE("deconvlucyaccel");
+
+	w2 = psf->width;
+	h2 = psf->height;
+
+	if (psf->channels > 1) {
+		printf("deconvlucyaccel: PSF should be a grayscale image\n");
+		return 0;
+	}
+	if (w2%2 != 1 || h2%2 != 1) {
+		printf("deconvlucyaccel: PSF cannot be of a size (%d, %d)\n", w2, h2);
+		return 0;
+	}
+
+	channels = image->channels;
+	w1 = image->width;
+	h1 = image->height;
+	size1 = w1*h1;
+
+	//   
+	div = getPSFDivisor(psf);
+	if (div == 0) {
+		return 0;
+	}
+
+	latent = copyImage(image);
+	prev = copyImage(image);
+	predicted = createTypedImage<T>(w1, h1, channels);
+	step = createTypedImage<T>(w1, h1, channels);
+	temp1 = createTypedImage<T>(w1, h1, channels);
+	temp2 = createTypedImage<T>(w1, h1, channels);
+	psf_inv = mirrorPSF(psf);
+	plan = createConvPlan(psf, w1, h1, method);
+	plan_inv = createConvPlan(psf_inv, w1, h1, method);
+	rows = 0;
+	if (rules != 0) {
+		_start_convergence(&convergence, rules);
+		rows = new double[3*channels*h1];
+	}
+	task.width = w1;
+	task.height = h1;
+	task.rows = new double[4*channels*h1];
+
+	//   callback,    
+	progress = (rules == 0 || rules->callback == 0);
+
+	alpha = 0.0;
+	for (t = 0; t < iterations; t++) {
+		TRACE_SCOPE("lucy iteration");
+		if (progress) printf("*%d", t);
+		// ,   
+		task.latent = latent->map;
+		task.prev = prev->map;
+		task.predicted = predicted->map;
+		task.step = step->map;
+		task.result = temp2->map;
+		task.alpha = alpha;
+		parallel_for(channels*h1, _extrapolate_range<T>, &task);
+
+		//  -   ,   temp2
+		_convplan(predicted->map, plan, channels, temp1->map);
+		_divide_maps(image->map, temp1->map, channels, w1, h1, rows);
+		_convplan(temp1->map, plan_inv, channels, temp2->map);
+		_multiply_maps(temp2->map, predicted->map, channels, w1, h1);
+
+		//       
+		parallel_for(channels*h1, _accel_step_range<T>, &task);
+		product = _sum_rows(task.rows, channels*h1, 0, 4);
+		step_norm = _sum_rows(task.rows, channels*h1, 1, 4);
+		change = _sum_rows(task.rows, channels*h1, 2, 4);
+		norm = _sum_rows(task.rows, channels*h1, 3, 4);
+		alpha = (step_norm > 0) ? product/step_norm : 0.0;
+		if (alpha < 0) alpha = 0.0;
+		if (alpha > 1) alpha = 1.0;
+
+		swap = step; step = predicted; predicted = swap;
+		swap = prev; prev = latent; latent = temp2; temp2 = swap;
+
+		//     ,    
+		if (rules != 0 && _converged(&convergence,
+			_relative(_sum_rows(rows, channels*h1, 0), _sum_rows(rows, channels*h1, 1)),
+			_relative(change, norm), _sum_rows(rows, channels*h1, 2)/(channels*size1))) {
+			t++;
+			break;
+		}
+		if (norm > 0 && sqrt(change/norm) < threshold) {
+			t++;
+			break;
+		}
+	}
+	if (progress) printf("\n");
+	printf("deconvlucyaccel: %d iterations\n", t);
+	if (rules != 0 && convergence.reason != STOP_ITERATIONS) {
+		printf("deconvlucyaccel: stopped by %s\n", stop_reasons[convergence.reason]);
+	}
+	delete [] rows;
+	delete [] task.rows;
+
+	deleteImage(prev);
+	deleteImage(predicted);
+	deleteImage(step);
+	deleteImage(temp1);
+	deleteImage(temp2);
+	deleteConvPlan(plan);
+	deleteConvPlan(plan_inv);
+	deleteImage(psf_inv);
+	return latent;
+}
+
+/*
+ *     FreeImage
+ */
+void _bitmap_read(TILE_STORE *store, int x, int y, OUT IMAGE *tile) {
+	FIBITMAP *bitmap = (FIBITMAP *)store->data;
+	int i, j, k; //  
+	int sx, sy; //    
+	int count; //       
+	double *rows[3]; //    
+
+	for (j = 0; j < tile->height; j++) {
+		sy = ((y + j)%store->height + store->height)%store->height;
+		for (i = 0; i < tile->width; i += count) {
+			sx = ((x + i)%store->width + store->width)%store->width;
+			count = store->width - sx;
+			if (count > tile->width - i) {
+				count = tile->width - i;
+			}
+			for (k = 0; k < tile->channels; k++) {
+				rows[k] = tile->map[k] + j*tile->width + i;
+			}
+			_read_scanline(bitmap, sy, sx, count, tile->channels, rows);
+		}
+	}
+}
+
+/*
+ *     FreeImage
+ */
+void _bitmap_write(TILE_STORE *store, int x, int y, IN IMAGE *tile, int ox, int oy, int w, int h) {
+	FIBITMAP *bitmap = (FIBITMAP *)store->data;
+	int j, k; //  
+	double *rows[3]; //   
+
+	for (j = 0; j < h; j++) {
+		for (k = 0; k < tile->channels; k++) {
+			rows[k] = tile->map[k] + (oy + j)*tile->width + ox;
+		}
+		_write_scanline(bitmap, y + j, x, w, tile->channels, rows);
+	}
+}
+
+void _bitmap_close(TILE_STORE *store) {
+	FreeImage_Unload((FIBITMAP *)store->data);
+}
+
+/*
+ *     .    
+ *  FreeImage   ,   double  
+ */
+TILE_STORE *openTileStore(const char *name, int type) {
+	TILE_STORE *store; //  
+	FIBITMAP *bitmap; //  
+	FREE_IMAGE_FORMAT fif; //  
+
+	fif = _image_format(type);
+	if (fif == FIF_UNKNOWN) {
+		printf("openTileStore: unknown file format: %d\n", type);
+		return 0;
+	}
+	bitmap = FreeImage_Load(fif, name, 0);
+	if (bitmap == 0) {
+		printf("openTileStore: image was not loaded\n");
+		return 0;
+	}
+	bitmap = _readable_bitmap(bitmap);
+	if (bitmap == 0) {
+		printf("openTileStore: unsupported pixel type\n");
+		return 0;
+	}
+	store = new TILE_STORE();
+	store->width = FreeImage_GetWidth(bitmap);
+	store->height = FreeImage_GetHeight(bitmap);
+	store->channels = 3;
+	store->data = bitmap;
+	store->read = _bitmap_read;
+	store->write = _bitmap_write;
+	store->close = _bitmap_close;
+	return store;
+}
+
+/*
+ *       
+ */
+TILE_STORE *createTileStore(int width, int height, int channels) {
+	TILE_STORE *store; //  
+	FIBITMAP *bitmap; // 
+
+	bitmap = FreeImage_Allocate(width, height, 24);
+	if (bitmap == 0) {
+		printf("createTileStore: image was not created\n");
+		return 0;
+	}
+	store = new TILE_STORE();
+	store->width = width;
+	store->height = height;
+	store->channels = channels;
+	store->data = bitmap;
+	store->read = _bitmap_read;
+	store->write = _bitmap_write;
+	store->close = _bitmap_close;
+	return store;
+}
+
+/*
+ *  ,  createTileStore()  openTileStore()
+ */
+void saveTileStore(TILE_STORE *store, const char *name, int type) {
+	FREE_IMAGE_FORMAT fif; //  
+
+	fif = _image_format(type);
+	if (fif == FIF_UNKNOWN) {
+		printf("saveTileStore: unknown file format: %d\n", type);
+		return;
+	}
+	if (!FreeImage_Save(fif, (FIBITMAP *)store->data, name)) {
+		printf("saveTileStore: bitmap couldn\'t be saved\n");
+	}
+}
+
+/*
+ *  
+ */
+void closeTileStore(TILE_STORE *store) {
+	if (store == 0) {
+		return;
+	}
+	store->close(store);
+	delete store;
+}
+
+/*
+ *       
+ */
+template <class T>
+void _read_region(IMAGE_T<T> *image, int x, int y, OUT IMAGE *tile) {
+	int i, j, k; //  
+	int sx, sy; //    
+
+	for (k = 0; k < tile->channels; k++) {
+		for (j = 0; j < tile->height; j++) {
+			sy = ((y + j)%image->height + image->height)%image->height;
+			for (i = 0; i < tile->width; i++) {
+				sx = ((x + i)%image->width + image->width)%image->width;
+				tile->map[k][j*tile->width + i] = image->map[k][sy*image->width + sx];
+			}
+		}
+	}
+}
+
+/*
+ *   (ox, oy, w, h)      (x, y)
+ */
+template <class T>
+void _write_region(IMAGE_T<T> *image, int x, int y, IN IMAGE *tile, int ox, int oy, int w, int h) {
+	int i, j, k; //  
+
+	for (k = 0; k < image->channels; k++) {
+		for (j = 0; j < h; j++) {
+			for (i = 0; i < w; i++) {
+				image->map[k][(y + j)*image->width + x + i] = (T)tile->map[k][(oy + j)*tile->width + ox + i];
+			}
+		}
+	}
+}
+
+/*
+ *      
+ */
+void _image_read(TILE_STORE *store, int x, int y, OUT IMAGE *tile) {
+	_read_region((IMAGE *)store->data, x, y, tile);
+}
+
+/*
+ *      
+ */
+void _image_write(TILE_STORE *store, int x, int y, IN IMAGE *tile, int ox, int oy, int w, int h) {
+	_write_region((IMAGE *)store->data, x, y, tile, ox, oy, w, h);
+}
+
+void _image_close(TILE_STORE *) {
+}
+
+/*
+ *      .   
+ *      
+ */
+TILE_STORE *createImageTileStore(IMAGE *image) {
+	TILE_STORE *store; //  
+
+	store = new TILE_STORE();
+	store->width = image->width;
+	store->height = image->height;
+	store->channels = image->channels;
+	store->data = image;
+	store->read = _image_read;
+	store->write = _image_write;
+	store->close = _image_close;
+	return store;
+}
+
+/*
+ *     
+ */
+void _raw_read(TILE_STORE *store, int x, int y, OUT IMAGE *tile) {
+	RAW_FILE *file = (RAW_FILE *)store->data;
+
+	if (file->header->sample == 8) {
+		_read_region(&file->image, x, y, tile);
+	} else {
+		_read_region(&file->float_image, x, y, tile);
+	}
+}
+
+/*
+ *     
+ */
+void _raw_write(TILE_STORE *store, int x, int y, IN IMAGE *tile, int ox, int oy, int w, int h) {
+	RAW_FILE *file = (RAW_FILE *)store->data;
+
+	if (file->header->sample == 8) {
+		_write_region(&file->image, x, y, tile, ox, oy, w, h);
+	} else {
+		_write_region(&file->float_image, x, y, tile, ox, oy, w, h);
+	}
+}
+
+/*
+ *   ,    :   
+ * ,   
+ */
+void _read_only_write(TILE_STORE *, int x, int y, IN IMAGE *, int, int, int, int) {
+	printf("tile store: cannot write at (%d, %d), the store is read-only\n", x, y);
+}
+
+void _raw_close(TILE_STORE *store) {
+	closeRawFile((RAW_FILE *)store->data);
+}
+
+/*
+ *     :     
+ *  ,    .   
+ *       
+ */
+TILE_STORE *_raw_tile_store(RAW_FILE *file) {
+	TILE_STORE *store; //  
+
+	if (file == 0) {
+		return 0;
+	}
+	store = new TILE_STORE();
+	store->width = file->header->width;
+	store->height = file->header->height;
+	store->channels = file->header->channels;
+	store->data = file;
+	store->read = _raw_read;
+	store->write = file->writable ? _raw_write : _read_only_write;
+	store->close = _raw_close;
+	return store;
+}
+
+/*
+ *       RAW
+ */
+TILE_STORE *openRawTileStore(const char *name, bool writable = false) {
+	return _raw_tile_store(openRawFile(name, writable));
+}
+
+/*
+ *       RAW.  
+ *    ,     
+ */
+TILE_STORE *createRawTileStore(const char *name, int width, int height, int channels,
+							   int sample = sizeof(float)) {
+	return _raw_tile_store(createRawFile(name, width, height, channels, sample));
+}
+
+typedef IMAGE *(*TILE_FUNCTION)(IMAGE *tile, IMAGE *psf, void *context);
+
+/*
+ *    tile_size x tile_size.  
+ *     halo,   process,  
+ *      (overlap-save).  
+ *  ,        ,
+ *      .      
+ */
+void processTiled(TILE_STORE *in, TILE_STORE *out, IMAGE *psf, TILE_FUNCTION process,
+				  void *context, int tile_size, int halo) {
+	int x, y; //    
+	int w, h; //   
+	IMAGE *tile; //   
+	IMAGE *result; //  
+
+	if (in->width != out->width || in->height != out->height) {
+		printf("processTiled: stores have different sizes\n");
+		return;
+	}
+	if (tile_size < 1 || halo < 0) {
+		printf("processTiled: wrong tile size %d or halo %d\n", tile_size, halo);
+		return;
+	}
+	if (out->write == _read_only_write) {
+		printf("processTiled: the output store is read-only\n");
+		return;
+	}
+	for (y = 0; y < in->height; y += tile_size) {
+		h = (in->height - y < tile_size) ? in->height - y : tile_size;
+		for (x = 0; x < in->width; x += tile_size) {
+			w = (in->width - x < tile_size) ? in->width - x : tile_size;
+			TRACE_SCOPE("tile");
+			tile = createImage(w + 2*halo, h + 2*halo, in->channels);
+			in->read(in, x - halo, y - halo, tile);
+			result = process(tile, psf, context);
+			deleteImage(tile);
+			if (result == 0) {
+				printf("processTiled: tile (%d, %d) failed\n", x, y);
+				return;
+			}
+			out->write(out, x, y, result, halo, halo, w, h);
+			deleteImage(result);
+		}
+	}
+}
+
+struct LUCY_TILE {
+	int iterations; //  
+	int method; //  
+	WORKSPACE *workspace; //  ,     
+};
+
+IMAGE *_lucy_tile(IMAGE *tile, IMAGE *psf, void *context) {
+	LUCY_TILE *params = (LUCY_TILE *)context;
+	IMAGE *latent; //    
+	IMAGE *result; //  
+
+	latent = deconvlucy(tile, psf, params->iterations, params->method, params->workspace);
+	result = (latent != 0) ? copyImage(latent) : 0;
+	workspaceReset(params->workspace);
+	return result;
+}
+
+/*
+ * ,   -     deconvlucy():
+ *      ,    , 
+ *       .   TILE_HALO_MAX
+ */
+int _lucy_halo(IMAGE *psf, int iterations) {
+	int radius; //  
+	int passes; //  
+
+	radius = (psf->width > psf->height ? psf->width : psf->height)/2;
+	passes = 2*((iterations > 1) ? iterations : 1);
+	return (radius > TILE_HALO_MAX/passes) ? TILE_HALO_MAX : radius*passes;
+}
+
+/*
+ *  -  .    
+ * _lucy_halo(), 2*iterations*.     
+ * ,        
+ *  
+ */
+void deconvlucytiled(TILE_STORE *in, TILE_STORE *out, IMAGE *psf, int iterations,
+					 int tile_size = TILE_SIZE, int halo = -1, int method = CONV_FFT) {
+	LUCY_TILE params; //   
+
+	if (halo < 0) {
+		halo = _lucy_halo(psf, iterations);
+	}
+	params.iterations = iterations;
+	params.method = method;
+	params.workspace = createWorkspace();
+	processTiled(in, out, psf, _lucy_tile, &params, tile_size, halo);
+	deleteWorkspace(params.workspace);
+}
+
+/*
+ *  : cols x rows , psf[row*cols + col] -  . 
+ * ,   - 
+ */
+PSF_GRID *createPSFGrid(IMAGE **psf, int cols, int rows) {
+	PSF_GRID *grid; //  
+	int i, n; //     
+
+	if (cols < 1 || rows < 1) {
+		printf("createPSFGrid: grid cannot be of a size (%d, %d)\n", cols, rows);
+		return 0;
+	}
+	n = cols*rows;
+	for (i = 0; i < n; i++) {
+		if (psf[i]->channels > 1 || psf[i]->width%2 != 1 || psf[i]->height%2 != 1
+			|| getPSFDivisor(psf[i]) == 0) {
+			printf("createPSFGrid: wrong PSF in cell %d\n", i);
+			return 0;
+		}
+	}
+	grid = new PSF_GRID();
+	grid->cols = cols;
+	grid->rows = rows;
+	grid->psf = new IMAGE*[n];
+	grid->psf_inv = new IMAGE*[n];
+	grid->plan = new CONV_PLAN*[n];
+	grid->plan_inv = new CONV_PLAN*[n];
+	for (i = 0; i < n; i++) {
+		grid->psf[i] = psf[i];
+		grid->psf_inv[i] = mirrorPSF(psf[i]);
+		grid->plan[i] = 0;
+		grid->plan_inv[i] = 0;
+	}
+	return grid;
+}
+
+/*
+ *      
+ */
+void deletePSFGrid(PSF_GRID *grid) {
+	int i; //  
+
+	if (grid == 0) {
+		return;
+	}
+	for (i = 0; i < grid->cols*grid->rows; i++) {
+		deleteImage(grid->psf_inv[i]);
+		deleteConvPlan(grid->plan[i]);
+		deleteConvPlan(grid->plan_inv[i]);
+	}
+	delete [] grid->psf;
+	delete [] grid->psf_inv;
+	delete [] grid->plan;
+	delete [] grid->plan_inv;
+	delete grid;
+}
+
+/*
+ *    index  count    size:  
+ *     
+ */
+void _grid_span(int index, int count, int size, OUT int *begin, OUT int *end) {
+	double step; //  
+
+	step = (double)size/count;
+	*begin = (index == 0) ? 0 : (int)floor(index*step - step/2);
+	*end = (index == count - 1) ? size : (int)ceil((index + 1)*step + step/2);
+	if (*begin < 0) *begin = 0;
+	if (*end > size) *end = size;
+}
+
+/*
+ *   index   x:       
+ * ,         1
+ */
+double _grid_weight(int x, int index, int count, int size) {
+	double step, center, weight; //    , 
+
+	step = (double)size/count;
+	center = (index + 0.5)*step;
+	if ((index == 0 && x + 0.5 <= center) || (index == count - 1 && x + 0.5 >= center)) {
+		return 1.0;
+	}
+	weight = 1.0 - fabs(x + 0.5 - center)/step;
+	return (weight > 0) ? weight : 0.0;
+}
+
+struct GRID_TASK {
+	PSF_GRID *grid; //  
+	TILE_STORE *store; //  
+	IMAGE **results; //   
+	int operation; // GRID_CONV  GRID_LUCY
+	int iterations; //  
+	int method; //  
+	int halo; //   
+};
+
+/*
+ *   begin ... end - 1
+ */
+void _grid_range(void *context, int begin, int end) {
+	GRID_TASK *task = (GRID_TASK *)context;
+	PSF_GRID *grid = task->grid;
+	int n; //  
+	int x0, x1, y0, y1; //  
+	int w, h; //    
+	IMAGE *tile; //    
+	CONV_PLAN *plan; //   
+
+	for (n = begin; n < end; n++) {
+		_grid_span(n%grid->cols, grid->cols, task->store->width, &x0, &x1);
+		_grid_span(n/grid->cols, grid->rows, task->store->height, &y0, &y1);
+		w = x1 - x0 + 2*task->halo;
+		h = y1 - y0 + 2*task->halo;
+		tile = createImage(w, h, task->store->channels);
+		task->store->read(task->store, x0 - task->halo, y0 - task->halo, tile);
+
+		//   ,     
+		plan = grid->plan[n];
+		if (plan == 0 || plan->w1 != w || plan->h1 != h || plan->requested != task->method) {
+			deleteConvPlan(grid->plan[n]);
+			deleteConvPlan(grid->plan_inv[n]);
+			grid->plan[n] = createConvPlan(grid->psf[n], w, h, task->method);
+			grid->plan_inv[n] = createConvPlan(grid->psf_inv[n], w, h, task->method);
+		}
+
+		if (task->operation == GRID_LUCY) {
+			task->results[n] = _lucy(tile, grid->plan[n], grid->plan_inv[n], task->iterations, false);
+		} else {
+			task->results[n] = createImage(w, h, tile->channels);
+			_convplan(tile->map, grid->plan[n], tile->channels, task->results[n]->map);
+		}
+		deleteImage(tile);
+	}
+}
+
+/*
+ *        .   
+ *            halo
+ * (    -   ,  - -
+ *  _lucy_halo()),   .
+ *    ,     
+ * .     ,    
+ *      
+ */
+IMAGE *_processgrid(IMAGE *image, PSF_GRID *grid, int operation, int iterations, int method, int halo) {
+	GRID_TASK task; //    
+	IMAGE *result; //  
+	IMAGE *part; //   
+	int n, k, x, y; //  
+	int x0, x1, y0, y1; //  
+	int cells; //  
+	double weight; //    
+	TRACE_SCOPE("psf grid");
+
+	cells = grid->cols*grid->rows;
+	if (halo < 0) {
+		halo = 0;
+		for (n = 0; n < cells; n++) {
+			if (operation == GRID_LUCY) {
+				if (_lucy_halo(grid->psf[n], iterations) > halo) halo = _lucy_halo(grid->psf[n], iterations);
+			} else {
+				if (grid->psf[n]->width/2 > halo) halo = grid->psf[n]->width/2;
+				if (grid->psf[n]->height/2 > halo) halo = grid->psf[n]->height/2;
+			}
+		}
+	}
+
+	task.grid = grid;
+	task.store = createImageTileStore(image);
+	task.results = new IMAGE*[cells];
+	task.operation = operation;
+	task.iterations = iterations;
+	task.method = method;
+	task.halo = halo;
+	parallel_for(cells, _grid_range, &task);
+
+	result = createImage(image->width, image->height, image->channels);
+	for (n = 0; n < cells; n++) {
+		part = task.results[n];
+		_grid_span(n%grid->cols, grid->cols, image->width, &x0, &x1);
+		_grid_span(n/grid->cols, grid->rows, image->height, &y0, &y1);
+		for (y = y0; y < y1; y++) {
+			for (x = x0; x < x1; x++) {
+				weight = _grid_weight(x, n%grid->cols, grid->cols, image->width)
+					*_grid_weight(y, n/grid->cols, grid->rows, image->height);
+				if (weight == 0) continue;
+				for (k = 0; k < image->channels; k++) {
+					result->map[k][y*image->width + x] +=
+						weight*part->map[k][(y - y0 + halo)*part->width + x - x0 + halo];
+				}
+			}
+		}
+		deleteImage(part);
+	}
+	delete [] task.results;
+	closeTileStore(task.store);
+	return result;
+}
+
+/*
+ *    
+ */
+IMAGE *convgrid(IMAGE *image, PSF_GRID *grid, int method = CONV_FFT, int halo = -1) {
+	return _processgrid(image, grid, GRID_CONV, 0, method, halo);
+}
+
+/*
+ *  -   
+ */
+IMAGE *deconvlucygrid(IMAGE *image, PSF_GRID *grid, int iterations, int method = CONV_FFT, int halo = -1) {
+	return _processgrid(image, grid, GRID_LUCY, iterations, method, halo);
+}
+
+/*
+ *  
+ */
+IMAGE *superresolution(IMAGE *image) {
+	IMAGE *big_image; //  
+	int w, h; //   
+	int channels; //    
+	int i, j, k; //  		
+	double *map; //    
+	double *big_map; //    
+	double value; //    
+	TRACE_SCOPE("superresolution");
+
+	w = image->width;
+	h = image->height;
+	channels = image->channels;
+	big_image = createImage(w*2, h*2, channels);
+
+	for (k = 0; k < channels; k++) {
+		map = image->map[k];
+		big_map = big_image->map[k];
+		//big_map[0] = 1.0;
+		for (i = 0; i < w; i++) {
+			for (j = 0; j < h; j++) {
+				//big_map[i*h*2 + j] = map[(i/2)*h + j/2];
+				value = map[j*w + i];
+				big_map[(2*j)*(w*2) + i*2] = value;
+				big_map[(2*j)*(w*2) + i*2 + 1] = (value + map[j*w + (i+1)%w])/2;
+				big_map[(2*j)*(w*2) + w*2 + i*2] = (value + map[((j+1)%h)*w + i])/2;
+				big_map[(2*j)*(w*2) + w*2 + i*2 + 1] = (value + map[((j+1)%h)*w + (i+1)%w])/2;
+			}
+		}
+	}
+	big_map = big_image->map[k];
+	return big_image;
+}
+
+/*
+ *   ,   2x2
+ */
+IMAGE *downsample(IMAGE *image) {
+	IMAGE *small_image; //  
+	int w, h; //   
+	int i, j, k; //  
+	double *map, *small_map; //      
+
+	w = image->width/2;
+	h = image->height/2;
+	small_image = createImage(w, h, image->channels);
+	for (k = 0; k < image->channels; k++) {
+		map = image->map[k];
+		small_map = small_image->map[k];
+		for (j = 0; j < h; j++) {
+			for (i = 0; i < w; i++) {
+				small_map[j*w + i] = (map[2*j*image->width + 2*i] + map[2*j*image->width + 2*i + 1]
+					+ map[(2*j + 1)*image->width + 2*i] + map[(2*j + 1)*image->width + 2*i + 1])/4;
+			}
+		}
+	}
+	return small_image;
+}
+
+/*
+ *     (width, height)  
+ *  
+ */
+IMAGE *_resize_psf(IMAGE *psf, int width, int height) {
+	IMAGE *result; //  
+	int i, j; //  
+	int a, b, a0, b0; //     
+	int x0, y0; //       
+	double x, y, fx, fy; //       
+	double *map; //    
+
+	result = createImage(width, height, 1);
+	a = width/2;
+	b = height/2;
+	a0 = psf->width/2;
+	b0 = psf->height/2;
+	map = psf->map[0];
+	for (j = 0; j < height; j++) {
+		for (i = 0; i < width; i++) {
+			x = (a > 0) ? a0 + (double)(i - a)*a0/a : a0;
+			y = (b > 0) ? b0 + (double)(j - b)*b0/b : b0;
+			x0 = (int)floor(x);
+			y0 = (int)floor(y);
+			fx = x - x0;
+			fy = y - y0;
+			if (x0 >= psf->width - 1) { x0 = psf->width - 1; fx = 0; }
+			if (y0 >= psf->height - 1) { y0 = psf->height - 1; fy = 0; }
+			result->map[0][j*width + i] = (1 - fx)*(1 - fy)*map[y0*psf->width + x0]
+				+ (fx > 0 ? fx*(1 - fy)*map[y0*psf->width + x0 + 1] : 0)
+				+ (fy > 0 ? (1 - fx)*fy*map[(y0 + 1)*psf->width + x0] : 0)
+				+ (fx > 0 && fy > 0 ? fx*fy*map[(y0 + 1)*psf->width + x0 + 1] : 0);
+		}
+	}
+	return result;
+}
+
+/*
+ *  :   ,    
+ * 
+ */
+void _shock_filter(double *map, int w, int h, int iterations, double dt) {
+	int t, x, y; //  
+	double *buf; //  
+	double gx, gy, lap; //   
+	double left, right, up, down, center; //  
+
+	buf = new double[w*h];
+	for (t = 0; t < iterations; t++) {
+		for (x = 0; x < w*h; x++) {
+			buf[x] = map[x];
+		}
+		for (y = 0; y < h; y++) {
+			for (x = 0; x < w; x++) {
+				center = buf[y*w + x];
+				left = buf[y*w + (x + w - 1)%w];
+				right = buf[y*w + (x + 1)%w];
+				up = buf[((y + h - 1)%h)*w + x];
+				down = buf[((y + 1)%h)*w + x];
+				gx = (right - left)/2;
+				gy = (down - up)/2;
+				lap = left + right + up + down - 4*center;
+				if (lap > 0) {
+					map[y*w + x] -= dt*sqrt(gx*gx + gy*gy);
+				} else if (lap < 0) {
+					map[y*w + x] += dt*sqrt(gx*gx + gy*gy);
+				}
+			}
+		}
+	}
+	delete [] buf;
+}
+
+/*
+ *     .   threshold 
+ */
+void _gradients(IN double *map, int w, int h, double threshold, OUT double *gx, OUT double *gy) {
+	int x, y; //  
+
+	for (y = 0; y < h; y++) {
+		for (x = 0; x < w; x++) {
+			gx[y*w + x] = map[y*w + (x + 1)%w] - map[y*w + x];
+			gy[y*w + x] = map[((y + 1)%h)*w + x] - map[y*w + x];
+			if (sqrt(gx[y*w + x]*gx[y*w + x] + gy[y*w + x]*gy[y*w + x]) < threshold) {
+				gx[y*w + x] = 0;
+				gy[y*w + x] = 0;
+			}
+		}
+	}
+}
+
+/*
+ *   ,    count 
+ */
+double _gradient_threshold(IN double *map, int w, int h, int count) {
+	int i, x, y; //  
+	int histogram[256]; //   
+	double gx, gy, value, top; //    
+
+	top = 0;
+	for (y = 0; y < h; y++) {
+		for (x = 0; x < w; x++) {
+			gx = map[y*w + (x + 1)%w] - map[y*w + x];
+			gy = map[((y + 1)%h)*w + x] - map[y*w + x];
+			value = sqrt(gx*gx + gy*gy);
+			if (value > top) top = value;
+		}
+	}
+	if (top == 0) {
+		return 0;
+	}
+	for (i = 0; i < 256; i++) {
+		histogram[i] = 0;
+	}
+	for (y = 0; y < h; y++) {
+		for (x = 0; x < w; x++) {
+			gx = map[y*w + (x + 1)%w] - map[y*w + x];
+			gy = map[((y + 1)%h)*w + x] - map[y*w + x];
+			i = (int)(255*sqrt(gx*gx + gy*gy)/top);
+			histogram[i]++;
+		}
+	}
+	for (i = 255, x = 0; i > 0; i--) {
+		x += histogram[i];
+		if (x >= count) break;
+	}
+	return top*i/255;
+}
+
+/*
+ *        latent   blurred:
+ *  |grad(latent)*k - grad(blurred)|^2 + weight*|k|^2  
+ * ,      
+ */
+void _estimate_kernel(IN double *latent, IN double *blurred, int w, int h, double weight,
+					  double threshold, IMAGE *psf) {
+	FFT_KERNEL *kernel; //     
+	int size; //     
+	int i, j, x, y; //  
+	int a, b, fw, fh; //     
+	double *gx, *gy; //  
+	comp *lx, *ly, *bx; //  
+	double top; //   
+	double energy; //    
+	double cx, cy, sum; //     
+	double *map; //   
+
+	kernel = createFFTKernel(psf, w, h);
+	size = kernel->spectrum_size;
+	fw = kernel->fft_width;
+	fh = kernel->fft_height;
+	gx = new double[w*h];
+	gy = new double[w*h];
+	lx = new comp[size];
+	ly = new comp[size];
+	bx = new comp[size];
+
+	_gradients(latent, w, h, threshold, gx, gy);
+	_image_spectrum(gx, kernel);
+	for (i = 0; i < size; i++) lx[i] = kernel->buf[i];
+	_image_spectrum(gy, kernel);
+	for (i = 0; i < size; i++) ly[i] = kernel->buf[i];
+	_gradients(blurred, w, h, 0, gx, gy);
+	_image_spectrum(gx, kernel);
+	for (i = 0; i < size; i++) bx[i] = kernel->buf[i];
+	_image_spectrum(gy, kernel);
+
+	//       
+	energy = 0;
+	for (i = 0; i < size; i++) {
+		energy += norm(lx[i]) + norm(ly[i]);
+	}
+	energy = (energy > 0) ? energy/size : 1.0;
+	for (i = 0; i < size; i++) {
+		kernel->buf[i] = (conj(lx[i])*bx[i] + conj(ly[i])*kernel->buf[i])
+			/(norm(lx[i]) + norm(ly[i]) + weight*energy);
+	}
+	inverse_real_fourier_transform_2d(kernel->buf, kernel->area, fw, fh);
+
+	//        
+	a = psf->width/2;
+	b = psf->height/2;
+	map = psf->map[0];
+	top = 0;
+	for (j = 0; j < psf->height; j++) {
+		for (i = 0; i < psf->width; i++) {
+			x = (i - a + fw)%fw;
+			y = (j - b + fh)%fh;
+			map[j*psf->width + i] = kernel->area[y*fw + x];
+			if (map[j*psf->width + i] > top) top = map[j*psf->width + i];
+		}
+	}
+	if (top <= 0) {
+		//   ,    
+		for (i = 0; i < psf->width*psf->height; i++) {
+			map[i] = 0.0;
+		}
+		map[b*psf->width + a] = 1.0;
+		top = 1.0;
+	}
+	cx = 0;
+	cy = 0;
+	sum = 0;
+	for (j = 0; j < psf->height; j++) {
+		for (i = 0; i < psf->width; i++) {
+			x = j*psf->width + i;
+			map[x] = (map[x] > top/20) ? map[x]/top : 0.0;
+			cx += map[x]*i;
+			cy += map[x]*j;
+			sum += map[x];
+		}
+	}
+
+	//      ,   
+	//   ,      
+	x = (int)floor(cx/sum - a + 0.5);
+	y = (int)floor(cy/sum - b + 0.5);
+	if (x != 0 || y != 0) {
+		for (i = 0; i < psf->width*psf->height; i++) {
+			kernel->area[i] = map[i];
+			map[i] = 0.0;
+		}
+		for (j = 0; j < psf->height; j++) {
+			for (i = 0; i < psf->width; i++) {
+				if (i + x >= 0 && i + x < psf->width && j + y >= 0 && j + y < psf->height) {
+					map[j*psf->width + i] = kernel->area[(j + y)*psf->width + i + x];
 				}
-				sign = 1 - 2*((x+y)%2); //     (-1)^(x+y)
-				map[index1] = sign*real;
 			}
 		}
-		image->map[k] = map;
-		printf("\n");
 	}
-	printf("\n");
 
-	return image;
+	delete [] gx;
+	delete [] gy;
+	delete [] lx;
+	delete [] ly;
+	delete [] bx;
+	deleteFFTKernel(kernel);
 }
 
 /*
- *  
+ *     (width, height).   
+ * :       ,   
+ * iterations      
+ * -         , 
+ *     .   
+ *   ,     
  */
-IMAGE *deconvinverse(IMAGE *image, IMAGE *psf) {
-	int w1, h1, w2, h2; //    
-	int size1, size2; //     
-	int channels; //    
-	int i, j, k; //  
-	int a, b; //    
-	IMAGE *latent; //  
-	double div; //   
-	double *h, *g; //  
-
-	w2 = psf->width;
-	h2 = psf->height;
+IMAGE *estimatePSF(IMAGE *image, int width, int height, int iterations = 10) {
+	IMAGE *levels[32]; //   , levels[0] - 
+	IMAGE *psf, *next; //       
+	IMAGE *latent; //  
+	int count; //  
+	int l, t, i, k; //  
+	int w2, h2; //    
+	double threshold; //   
+	TRACE_SCOPE("estimatePSF");
 
-	if (psf->channels > 1) {
-		printf("deconvlucy: PSF should be a grayscale image\n");
-		return 0;
-	}
-	if (w2%2 != 1 || h2%2 != 1) {
-		printf("deconvlucy: PSF cannot be of a size (%d, %d)\n", w2, h2);
+	if (width%2 != 1 || height%2 != 1) {
+		printf("estimatePSF: PSF cannot be of a size (%d, %d)\n", width, height);
 		return 0;
 	}
 
-	a = w2/2; //     psf  
-	b = h2/2; //     psf  
-	channels = image->channels;
-	w1 = image->width;
-	h1 = image->height;
-	size1 = w1*h1;
-	size2 = w2*h2;
-
-	latent = createImage(w1, h1, channels);
-	//latent = copyImage(image);
-	h = psf->map[0];
-
-	//   
-	div = getPSFDivisor(psf);
-	if (div == 0) {
-		return 0;
+	//        3x3
+	levels[0] = createImage(image->width, image->height, 1);
+	for (i = 0; i < image->width*image->height; i++) {
+		for (k = 0; k < image->channels; k++) {
+			levels[0]->map[0][i] += image->map[k][i]/image->channels;
+		}
+	}
+	count = 1;
+	while (count < 32 && ((width >> count) > 1 || (height >> count) > 1)
+		   && levels[count - 1]->width >= 32 && levels[count - 1]->height >= 32) {
+		levels[count] = downsample(levels[count - 1]);
+		count++;
 	}
 
-	COMPLEX_ARRAYS *complex_image, *complex_psf;
-	int complex_size1, complex_size2;
-	comp *complex_image_map, *complex_psf_map, complex_value;
-
-	complex_image = _form_complex_array(image);
-	complex_size1 = complex_image->size;
-	complex_psf = _form_complex_array(psf, complex_size1);
-	//complex_size2 = complex_psf->size;
-	complex_psf_map = complex_psf->arrays[0];
+	//   - 
+	w2 = (width >> (count - 1)) | 1;
+	h2 = (height >> (count - 1)) | 1;
+	psf = createImage(w2, h2, 1);
+	psf->map[0][(h2/2)*w2 + w2/2] = 1.0;
 
-	fourier_transform(complex_psf_map, complex_size1);
-	for (k = 0; k < channels; k++) {
-		complex_image_map = complex_image->arrays[k];
-		fourier_transform(complex_image_map, complex_size1);
-		for (i = 0; i < complex_size1; i++) {
-			complex_value = complex_psf_map[i];
-			if (complex_value.imag() != 0 || complex_value.real() != 0) {
-				complex_image_map[i] /= complex_value;
-			}
+	for (l = count - 1; l >= 0; l--) {
+		printf("estimatePSF: level %d, image (%d, %d), PSF (%d, %d)\n",
+			l, levels[l]->width, levels[l]->height, psf->width, psf->height);
+		for (t = 0; t < iterations; t++) {
+			latent = deconvwiener(levels[l], psf, BLIND_WEIGHT, REG_LAPLACE);
+			_shock_filter(latent->map[0], latent->width, latent->height, 2, 0.5);
+			//     ,    
+			//      
+			threshold = _gradient_threshold(latent->map[0], latent->width, latent->height,
+				4*psf->width*psf->height);
+			_estimate_kernel(latent->map[0], levels[l]->map[0], latent->width, latent->height,
+				BLIND_KERNEL_WEIGHT, threshold, psf);
+			deleteImage(latent);
 		}
-	}
-	for (k = 0; k < channels; k++) {
-		complex_image_map = complex_image->arrays[k];
-		inverse_fourier_transform(complex_image_map, complex_size1);
-		for (i = 0; i < size1; i++) {
-			latent->map[k][i] = complex_image_map[i].real();
+		if (l > 0) {
+			w2 = (width >> (l - 1)) | 1;
+			h2 = (height >> (l - 1)) | 1;
+			next = _resize_psf(psf, w2, h2);
+			deleteImage(psf);
+			psf = next;
 		}
 	}
 
-	return latent;
+	for (l = 0; l < count; l++) {
+		deleteImage(levels[l]);
+	}
+	return psf;
 }
 
 /*
- *  -
+ *  :     -  .  psf
+ *  0,    
  */
-IMAGE *deconvlucy(IMAGE *image, IMAGE *psf, int iterations) {
-	int w1, h1, w2, h2; //    
-	int size1, size2; //     
-	int channels; //    
-	int i, j, k; //  
-	int a, b; //    
-	IMAGE *latent; //  
-	IMAGE *psf_inv; //  ,   psf(-x, -y)
-	IMAGE *temp1, *temp2; //     
-	double div; //   
-	double *h, *h_inv, *g, *t; //  
-
-	w2 = psf->width;
-	h2 = psf->height;
+IMAGE *deconvblind(IMAGE *image, int width, int height, int iterations, OUT IMAGE **psf = 0) {
+	IMAGE *estimate; //  
+	IMAGE *latent; //  
 
-	if (psf->channels > 1) {
-		printf("deconvlucy: PSF should be a grayscale image\n");
+	estimate = estimatePSF(image, width, height);
+	if (estimate == 0) {
 		return 0;
 	}
-	if (w2%2 != 1 || h2%2 != 1) {
-		printf("deconvlucy: PSF cannot be of a size (%d, %d)\n", w2, h2);
-		return 0;
+	latent = deconvlucyaccel(image, estimate, iterations);
+	if (psf != 0) {
+		*psf = estimate;
+	} else {
+		deleteImage(estimate);
 	}
+	return latent;
+}
 
-	a = w2/2; //     psf  
-	b = h2/2; //     psf  
-	channels = image->channels;
-	w1 = image->width;
-	h1 = image->height;
-	size1 = w1*h1;
-	size2 = w2*h2;
-
-	latent = copyImage(image);
-	temp1 = createImage(w1, h1, channels);
-	temp2 = createImage(w1, h1, channels);
-	psf_inv = createImage(w2, h2, 1);
+/*
+ *     (width, height) 
+ *      .   
+ * superresolution()   ,    , 
+ * upsample()   downsample()
+ */
+IMAGE *upsample(IMAGE *image, int width, int height) {
+	IMAGE *big_image; //  
+	int w, h; //   
+	int i, j, k; //  
+	int x0, y0, x1, y1; //    
+	double x, y, fx, fy; //       
+	double *map; //    
 
-	h = psf->map[0];
-	h_inv = psf_inv->map[0];
-	for (i = 0; i < size2; i++) {
-		h_inv[i] = h[size2 - i - 1];
+	w = image->width;
+	h = image->height;
+	big_image = createImage(width, height, image->channels);
+	for (j = 0; j < height; j++) {
+		y = (j + 0.5)*h/height - 0.5 + h;
+		y0 = (int)y;
+		fy = y - y0;
+		y0 = y0%h;
+		y1 = (y0 + 1)%h;
+		for (i = 0; i < width; i++) {
+			x = (i + 0.5)*w/width - 0.5 + w;
+			x0 = (int)x;
+			fx = x - x0;
+			x0 = x0%w;
+			x1 = (x0 + 1)%w;
+			for (k = 0; k < image->channels; k++) {
+				map = image->map[k];
+				big_image->map[k][j*width + i] = (1 - fy)*((1 - fx)*map[y0*w + x0] + fx*map[y0*w + x1])
+					+ fy*((1 - fx)*map[y1*w + x0] + fx*map[y1*w + x1]);
+			}
+		}
 	}
+	return big_image;
+}
 
-	//   
-	div = getPSFDivisor(psf);
-	if (div == 0) {
-		return 0;
-	}
+/*
+ *   .    d     
+ * d/2,       
+ */
+IMAGE *_downsample_psf(IMAGE *psf) {
+	IMAGE *result; //  
+	int a, b, a2, b2; //     
+	int w, h; //   
+	int i, j, p, q; //  
+	int xs[2], ys[2]; //   ,   
+	int nx, ny; //    
+	double value; //  
 
-	for (k = 0; k < iterations; k++) {
-		printf("*%d", k);
-		_conv(latent->map, h, channels, w1, h1, w2, h2, a, b, div, temp1->map);
-		for (j = 0; j < channels; j++) {
-			t = temp1->map[j];
-			g = image->map[j];
-			for (i = 0; i < size1; i++) {
-				t[i] = g[i]/t[i];
+	a = psf->width/2;
+	b = psf->height/2;
+	a2 = (a + 1)/2;
+	b2 = (b + 1)/2;
+	w = 2*a2 + 1;
+	h = 2*b2 + 1;
+	result = createImage(w, h, 1);
+	for (j = 0; j < psf->height; j++) {
+		for (i = 0; i < psf->width; i++) {
+			value = psf->map[0][j*psf->width + i];
+			if (value == 0) continue;
+			nx = 1;
+			xs[0] = (i - a + 2*a2)/2;
+			if ((i - a)%2 != 0) {
+				xs[1] = xs[0] + 1;
+				nx = 2;
 			}
-		}
-		_conv(temp1->map, h_inv, channels, w1, h1, w2, h2, a, b, div, temp2->map);
-		for (j = 0; j < channels; j++) {
-			g = latent->map[j];
-			t = temp2->map[j];
-			for (i = 0; i < size1; i++) {
-				g[i] = g[i]*t[i];
+			ny = 1;
+			ys[0] = (j - b + 2*b2)/2;
+			if ((j - b)%2 != 0) {
+				ys[1] = ys[0] + 1;
+				ny = 2;
+			}
+			for (p = 0; p < nx; p++) {
+				for (q = 0; q < ny; q++) {
+					result->map[0][ys[q]*w + xs[p]] += value/(nx*ny);
+				}
 			}
 		}
 	}
-	printf("\n");
-	deleteImage(temp1);
-	deleteImage(temp2);
-	deleteImage(psf_inv);
-	return latent;
+	return result;
 }
 
 /*
- *  
+ *  -   .   
+ *    levels ,     
+ * coarse_iterations ,     
+ *    .    
+ * iterations ,  rules    
  */
-IMAGE *superresolution(IMAGE *image) {
-	IMAGE *big_image; //  
-	int w, h; //   
-	int channels; //    
-	int i, j, k; //  		
-	double *map; //    
-	double *big_map; //    
-	double value; //    
+IMAGE *deconvlucymulti(IMAGE *image, IMAGE *psf, int iterations, int levels = 3,
+					   int coarse_iterations = 100, int method = CONV_FFT, STOP_RULES *rules = 0) {
+	IMAGE *images[16], *psfs[16], *psfs_inv[16]; //  
+	IMAGE *latent, *next; //      
+	CONV_PLAN *plan, *plan_inv; //   
+	int count; //  
+	int l; //  
+	CONVERGENCE convergence; //     
+	TRACE_SCOPE("deconvlucymulti");
 
-	w = image->width;
-	h = image->height;
-	channels = image->channels;
-	big_image = createImage(w*2, h*2, channels);
+	if (psf->channels > 1) {
+		printf("deconvlucymulti: PSF should be a grayscale image\n");
+		return 0;
+	}
+	if (psf->width%2 != 1 || psf->height%2 != 1) {
+		printf("deconvlucymulti: PSF cannot be of a size (%d, %d)\n", psf->width, psf->height);
+		return 0;
+	}
+	if (getPSFDivisor(psf) == 0) {
+		return 0;
+	}
 
-	for (k = 0; k < channels; k++) {
-		map = image->map[k];
-		big_map = big_image->map[k];
-		//big_map[0] = 1.0;
-		for (i = 0; i < w; i++) {
-			for (j = 0; j < h; j++) {
-				//big_map[i*h*2 + j] = map[(i/2)*h + j/2];
-				value = map[j*w + i];
-				big_map[(2*j)*(w*2) + i*2] = value;
-				big_map[(2*j)*(w*2) + i*2 + 1] = (value + map[j*w + (i+1)%w])/2;
-				big_map[(2*j)*(w*2) + w*2 + i*2] = (value + map[((j+1)%h)*w + i])/2;
-				big_map[(2*j)*(w*2) + w*2 + i*2 + 1] = (value + map[((j+1)%h)*w + (i+1)%w])/2;
-			}
+	images[0] = image;
+	psfs[0] = psf;
+	count = 1;
+	while (count < levels && count < 16 && images[count - 1]->width >= 32 && images[count - 1]->height >= 32
+		   && (psfs[count - 1]->width > 1 || psfs[count - 1]->height > 1)) {
+		images[count] = downsample(images[count - 1]);
+		psfs[count] = _downsample_psf(psfs[count - 1]);
+		count++;
+	}
+
+	latent = 0;
+	for (l = count - 1; l >= 0; l--) {
+		printf("deconvlucymulti: level %d, image (%d, %d)\n", l, images[l]->width, images[l]->height);
+		if (latent != 0) {
+			next = upsample(latent, images[l]->width, images[l]->height);
+			deleteImage(latent);
+			latent = next;
+		}
+		psfs_inv[l] = mirrorPSF(psfs[l]);
+		plan = createConvPlan(psfs[l], images[l]->width, images[l]->height, method);
+		plan_inv = createConvPlan(psfs_inv[l], images[l]->width, images[l]->height, method);
+		if (l == 0 && rules != 0) {
+			_start_convergence(&convergence, rules);
+		}
+		latent = _lucy(images[l], plan, plan_inv, (l == 0) ? iterations : coarse_iterations, false, latent,
+			(WORKSPACE *)0, (l == 0 && rules != 0) ? &convergence : 0);
+		if (l == 0 && rules != 0 && convergence.reason != STOP_ITERATIONS) {
+			printf("deconvlucymulti: stopped by %s after %d iterations\n", stop_reasons[convergence.reason],
+				convergence.metrics.iteration);
+		}
+		deleteConvPlan(plan);
+		deleteConvPlan(plan_inv);
+		deleteImage(psfs_inv[l]);
+		if (l > 0) {
+			deleteImage(images[l]);
+			deleteImage(psfs[l]);
 		}
 	}
-	big_map = big_image->map[k];
-	return big_image;
+	return latent;
 }
 
 /*
@@ -1049,45 +5126,468 @@ void normalize(IMAGE *image) {
 	}
 }
 
+const char *step_names[STEP_COUNT] = {
+	"grayscale", "inverse", "laplace", "normalize", "superresolution", "conv", "deconv",
+	"deconvinverse", "deconvwiener", "deconvlucy", "deconvlucyaccel", "deconvlucymulti"
+};
+
+/*
+ *    
+ */
+int _file_type(const char *name) {
+	const char *ext; // 
+	char lower[8]; //    
+	int i; //  
+
+	ext = strrchr(name, '.');
+	if (ext == 0 || strlen(ext) >= sizeof(lower)) {
+		return UNKNOWN;
+	}
+	for (i = 0; ext[i] != 0; i++) {
+		lower[i] = (char)tolower((unsigned char)ext[i]);
+	}
+	lower[i] = 0;
+	if (strcmp(lower, ".bmp") == 0) return BMP;
+	if (strcmp(lower, ".gif") == 0) return GIF;
+	if (strcmp(lower, ".jpg") == 0 || strcmp(lower, ".jpeg") == 0) return JPEG;
+	if (strcmp(lower, ".png") == 0) return PNG;
+	if (strcmp(lower, ".tif") == 0 || strcmp(lower, ".tiff") == 0) return TIFF;
+	if (strcmp(lower, ".raw") == 0) return RAW;
+	return UNKNOWN;
+}
+
+/*
+ *     "grayscale,deconvlucy:20,normalize"
+ */
+bool _parse_steps(BATCH *batch, const char *spec) {
+	char *text, *item, *colon; //  ,  ,   
+	char *number; //    
+	int count; //  
+	int op; //  
+	BATCH_STEP *step; //  
+
+	text = new char[strlen(spec) + 1];
+	strcpy(text, spec);
+	count = 1;
+	for (item = text; *item != 0; item++) {
+		if (*item == ',') count++;
+	}
+	delete [] batch->steps;
+	batch->steps = new BATCH_STEP[count];
+	batch->step_count = 0;
+
+	for (item = strtok(text, ","); item != 0; item = strtok(0, ",")) {
+		colon = strchr(item, ':');
+		if (colon != 0) {
+			*colon = 0;
+		}
+		for (op = 0; op < STEP_COUNT; op++) {
+			if (strcmp(item, step_names[op]) == 0) break;
+		}
+		if (op == STEP_COUNT) {
+			printf("batch: unknown operation %s\n", item);
+			delete [] text;
+			return false;
+		}
+		step = &batch->steps[batch->step_count++];
+		step->operation = op;
+		step->given = (colon != 0);
+		step->parameter = (colon != 0) ? atof(colon + 1) : 0;
+		step->snapshot_count = 0;
+		number = (colon != 0 && strchr(colon + 1, '/') != 0) ? colon + 1 : 0;
+		while (number != 0 && step->snapshot_count < BATCH_SNAPSHOTS) {
+			step->snapshots[step->snapshot_count++] = atoi(number);
+			number = strchr(number, '/');
+			if (number != 0) number++;
+		}
+	}
+	delete [] text;
+	return true;
+}
+
+/*
+ *   
+ */
+void _add_input(BATCH *batch, const char *name) {
+	int i; //  
+	char **inputs; //   
+
+	if (batch->input_count == batch->input_capacity) {
+		batch->input_capacity = (batch->input_capacity == 0) ? 16 : 2*batch->input_capacity;
+		inputs = new char*[batch->input_capacity];
+		for (i = 0; i < batch->input_count; i++) {
+			inputs[i] = batch->inputs[i];
+		}
+		delete [] batch->inputs;
+		batch->inputs = inputs;
+	}
+	batch->inputs[batch->input_count] = new char[strlen(name) + 1];
+	strcpy(batch->inputs[batch->input_count], name);
+	batch->input_count++;
+}
+
+int _compare_names(const void *a, const void *b) {
+	return strcmp(*(char **)a, *(char **)b);
+}
+
+/*
+ *        
+ */
+void _add_directory(BATCH *batch, const char *dir) {
+	std::string path; //   
+	int first; //      
+
+	first = batch->input_count;
+#ifdef _WIN32
+	WIN32_FIND_DATAA data; //  
+	HANDLE search; //   
+
+	search = FindFirstFileA((std::string(dir) + "\\*").c_str(), &data);
+	if (search == INVALID_HANDLE_VALUE) {
+		printf("batch: cannot read directory %s\n", dir);
+		return;
+	}
+	do {
+		if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && _file_type(data.cFileName) != UNKNOWN) {
+			path = std::string(dir) + "\\" + data.cFileName;
+			_add_input(batch, path.c_str());
+		}
+	} while (FindNextFileA(search, &data));
+	FindClose(search);
+#else
+	DIR *directory; //  
+	struct dirent *entry; //  
+
+	directory = opendir(dir);
+	if (directory == 0) {
+		printf("batch: cannot read directory %s\n", dir);
+		return;
+	}
+	while ((entry = readdir(directory)) != 0) {
+		if (entry->d_name[0] != '.' && _file_type(entry->d_name) != UNKNOWN) {
+			path = std::string(dir) + "/" + entry->d_name;
+			_add_input(batch, path.c_str());
+		}
+	}
+	closedir(directory);
+#endif
+	qsort(batch->inputs + first, batch->input_count - first, sizeof(char *), _compare_names);
+}
+
+/*
+ *  suffix     
+ */
+std::string _with_suffix(const std::string &name, const std::string &suffix) {
+	size_t slash, dot; //      
+
+	dot = name.rfind('.');
+	slash = name.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+		dot = name.size();
+	}
+	return name.substr(0, dot) + suffix + name.substr(dot);
+}
+
+/*
+ *  :     ,   ,
+ *   
+ */
+std::string _output_name(BATCH *batch, const char *input) {
+	std::string name; //  
+	size_t slash; //    
+
+	name = _with_suffix(input, batch->suffix);
+	if (batch->output_dir != 0) {
+		slash = name.find_last_of("/\\");
+		name = std::string(batch->output_dir) + "/"
+			+ ((slash == std::string::npos) ? name : name.substr(slash + 1));
+	}
+	return name;
+}
+
+/*
+ *    ,   first,   
+ *  output.  .  -  
+ *        _<>.
+ *  false,  -  
+ */
+bool _process(BATCH *batch, IMAGE *image, int first, WORKSPACE *workspace, const std::string &output, int type) {
+	int n, i; //     
+	BATCH_STEP *step; //  
+	IMAGE *result, *latent; //       
+	IMAGE *snapshots[BATCH_SNAPSHOTS]; //  -
+	int count; //  
+	char suffix[16]; //  
+	bool success; //    
+	std::string checkpoint; //   
+	STOP_RULES rules; //        
+	STOP_RULES *stop; //    0,   
+
+	rules = batch->rules;
+	rules.context = (void *)output.c_str();
+	stop = (rules.tolerance > 0 || rules.stagnation > 0 || rules.budget > 0 || rules.callback != 0) ? &rules : 0;
+
+	for (n = first; n < batch->step_count && image != 0; n++) {
+		step = &batch->steps[n];
+		TRACE_SCOPE(step_names[step->operation]);
+		count = step->given ? (int)step->parameter : 10;
+		result = image;
+		switch (step->operation) {
+			case STEP_GRAYSCALE:
+				if (image->channels == 3) grayscale(image);
+				break;
+			case STEP_INVERSE:
+				inverse(image);
+				break;
+			case STEP_LAPLACE:
+				laplace(image, (step->given && step->parameter == 8) ? EIGHT_SIDES : FOUR_SIDES);
+				break;
+			case STEP_NORMALIZE:
+				normalize(image);
+				break;
+			case STEP_SUPERRESOLUTION:
+				result = superresolution(image);
+				break;
+			case STEP_CONV:
+				result = conv(image, batch->psf, batch->method);
+				break;
+			case STEP_DECONV:
+				result = deconv(image, batch->psf, step->given ? step->parameter : 1e-4, 100, CONV_FFT, stop);
+				break;
+			case STEP_DECONVINVERSE:
+				result = deconvinverse(image, batch->psf);
+				break;
+			case STEP_DECONVWIENER:
+				result = deconvwiener(image, batch->psf, step->given ? step->parameter : 0.01);
+				break;
+			case STEP_DECONVLUCY:
+				if (step->snapshot_count > 0 || batch->checkpoint) {
+					//     ,      
+					checkpoint = output + ".ckpt";
+					deconvlucysweep(image, batch->psf, (step->snapshot_count > 0) ? step->snapshots : &count,
+						(step->snapshot_count > 0) ? step->snapshot_count : 1, snapshots,
+						batch->checkpoint ? checkpoint.c_str() : 0, batch->method, stop);
+					deleteImage(image);
+					success = true;
+					for (i = 0; i < ((step->snapshot_count > 0) ? step->snapshot_count : 1); i++) {
+						sprintf(suffix, "_%d", (step->snapshot_count > 0) ? step->snapshots[i] : count);
+						if (snapshots[i] == 0) {
+							printf("batch: deconvlucy failed\n");
+							success = false;
+						} else if (!_process(batch, snapshots[i], n + 1, workspace,
+							(step->snapshot_count > 0) ? _with_suffix(output, suffix) : output, type)) {
+							success = false;
+						}
+					}
+					return success;
+				}
+				//       
+				latent = deconvlucy(image, batch->psf, count, batch->method, workspace, stop);
+				result = (latent != 0) ? copyImage(latent) : 0;
+				if (latent != 0) {
+					releaseWorkspaceImage(workspace, latent);
+				}
+				break;
+			case STEP_DECONVLUCYACCEL:
+				result = deconvlucyaccel(image, batch->psf, count, 1e-4, batch->method, stop);
+				break;
+			case STEP_DECONVLUCYMULTI:
+				result = deconvlucymulti(image, batch->psf, count, 3, 100, batch->method, stop);
+				break;
+		}
+		if (result != image) {
+			deleteImage(image);
+			image = result;
+		}
+		if (image == 0) {
+			printf("batch: %s failed\n", step_names[step->operation]);
+			return false;
+		}
+	}
+	if (!saveImage(image, output.c_str(), type, batch->bits)) {
+		deleteImage(image);
+		return false;
+	}
+	printf("batch: saved %s\n", output.c_str());
+	deleteImage(image);
+	return true;
+}
+
+/*
+ *   begin ... end - 1  
+ */
+void _batch_range(void *context, int begin, int end) {
+	BATCH *batch = (BATCH *)context;
+	WORKSPACE *workspace; //   
+	IMAGE *image; //  
+	int n; //  
+	int type; //  
+
+	workspace = createWorkspace();
+	for (n = begin; n < end; n++) {
+		TRACE_SCOPE_NOTE("file", batch->inputs[n]);
+		type = _file_type(batch->inputs[n]);
+		image = (type == UNKNOWN) ? 0 : loadImage(batch->inputs[n], type);
+		if (image == 0 || !_process(batch, image, 0, workspace, _output_name(batch, batch->inputs[n]), type)) {
+			printf("batch: %s was not processed\n", batch->inputs[n]);
+			batch->mutex.lock();
+			batch->failed++;
+			batch->mutex.unlock();
+		}
+		workspaceReset(workspace);
+	}
+	deleteWorkspace(workspace);
+}
+
 /*
  * Main
+ *
+ * deconvolution [-psf file] [-steps list] [-method direct|fft|separable|auto]
+ *               [-j workers] [-o dir] [-suffix text] [-bits 8|16|32] [-checkpoint]
+ *               [-tolerance x] [-stagnation n] [-budget seconds] [-metrics]
+ *               [-trace file] [-dir dir] files...
+ *
+ *   ,      -steps
+ * (  BATCH_STEPS)        .
+ *           .
+ *   ,   -j  .
+ * -tolerance, -stagnation  -budget    
+ * , -metrics      .
+ * -trace     chrome://tracing,  
+ *   DECONV_TRACE
  */
-int main()
+int main(int argc, char **argv)
 {
-	IMAGE *image, *grayscale_image, *res_image;
-	IMAGE *blured;
-	IMAGE *psf;
-	BYTE *map;
-	//image = generateImage(130, 100, 3);
-	image = loadImage("images/no_noise.png", PNG);
-	//image = loadImage("images/naive.png", PNG);
-	//image = loadImage("images/houses/rastr4.bmp", BMP);
-	//psf = generatePSF(3, 3, PSF_RADIAL);
-	//psf = generatePSF(3, 3, PSF_LINEAR);
-	//saveImage(psf, "images/psf.png", PNG);
-	//printf("div = %f\n", getPSFDivisor(psf));
-	//psf = loadImage("psf/psf13x13_detected.png", PNG);
-	psf = loadImage("psf/psf19x19_motion.png", PNG);
-	//psf = loadImage("psf/psf5x5_blur.png", PNG);
-	//psf = loadImage("psf/psf5x5_identity.png", PNG);
-	grayscale(psf);
-
-	//grayscale(image);
-	//image = superresolution(superresolution(image));
-	//inverse(image);
-	//inverse(image);
-	//laplace(image, FOUR_SIDES);
-
-	image = _IFT(_FT(image));
-	//image = conv(image, psf);
-	//image = deconvinverse(image, psf);
-	//laplace(image, FOUR_SIDES);
-		
-	//image = deconvlucy(image, psf, 10);
-	normalize(image);
-	
-	//saveImage(image, "images/naive_conv_deconv.png", PNG);
-	saveImage(image, "images/no_noise_res.png", PNG);
-	return 0;
-}
+	BATCH batch; //  
+	const char *psf_name; //  
+	int workers; //    
+	int i, n; //  
+	bool need_psf; //    
+	const char *trace_name; //  
+
+	batch.steps = 0;
+	batch.step_count = 0;
+	batch.psf = 0;
+	batch.method = CONV_AUTO;
+	batch.inputs = 0;
+	batch.input_count = 0;
+	batch.input_capacity = 0;
+	batch.output_dir = 0;
+	batch.suffix = BATCH_SUFFIX;
+	batch.bits = 8;
+	batch.checkpoint = false;
+	batch.rules.tolerance = 0.0;
+	batch.rules.stagnation = 0;
+	batch.rules.budget = 0.0;
+	batch.rules.callback = 0;
+	batch.rules.context = 0;
+	batch.failed = 0;
+	psf_name = 0;
+	workers = 0;
+	trace_name = 0;
+	_parse_steps(&batch, BATCH_STEPS);
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-psf") == 0 && i + 1 < argc) {
+			psf_name = argv[++i];
+		} else if (strcmp(argv[i], "-steps") == 0 && i + 1 < argc) {
+			if (!_parse_steps(&batch, argv[++i])) {
+				return 1;
+			}
+		} else if (strcmp(argv[i], "-method") == 0 && i + 1 < argc) {
+			i++;
+			if (strcmp(argv[i], "direct") == 0) batch.method = CONV_DIRECT;
+			else if (strcmp(argv[i], "fft") == 0) batch.method = CONV_FFT;
+			else if (strcmp(argv[i], "separable") == 0) batch.method = CONV_SEPARABLE;
+			else batch.method = CONV_AUTO;
+		} else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			workers = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			batch.output_dir = argv[++i];
+		} else if (strcmp(argv[i], "-suffix") == 0 && i + 1 < argc) {
+			batch.suffix = argv[++i];
+		} else if (strcmp(argv[i], "-bits") == 0 && i + 1 < argc) {
+			batch.bits = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-checkpoint") == 0) {
+			batch.checkpoint = true;
+		} else if (strcmp(argv[i], "-tolerance") == 0 && i + 1 < argc) {
+			batch.rules.tolerance = atof(argv[++i]);
+		} else if (strcmp(argv[i], "-stagnation") == 0 && i + 1 < argc) {
+			batch.rules.stagnation = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-budget") == 0 && i + 1 < argc) {
+			batch.rules.budget = atof(argv[++i]);
+		} else if (strcmp(argv[i], "-metrics") == 0) {
+			batch.rules.callback = printMetrics;
+		} else if (strcmp(argv[i], "-trace") == 0 && i + 1 < argc) {
+			trace_name = argv[++i];
+		} else if (strcmp(argv[i], "-dir") == 0 && i + 1 < argc) {
+			_add_directory(&batch, argv[++i]);
+		} else if (argv[i][0] == '-') {
+			printf("main: unknown option %s\n", argv[i]);
+			return 1;
+		} else {
+			_add_input(&batch, argv[i]);
+		}
+	}
+	if (batch.input_count == 0) {
+		printf("usage: %s [-psf file] [-steps list] [-method direct|fft|separable|auto]\n"
+			"       [-j workers] [-o dir] [-suffix text] [-bits 8|16|32] [-checkpoint]\n"
+			"       [-tolerance x] [-stagnation n] [-budget seconds] [-metrics]\n"
+			"       [-trace file] [-dir dir] files...\n", argv[0]);
+		printf("steps (default %s):", BATCH_STEPS);
+		for (n = 0; n < STEP_COUNT; n++) {
+			printf(" %s", step_names[n]);
+		}
+		printf("\n");
+		return 1;
+	}
+
+	if (trace_name != 0) {
+#ifdef DECONV_TRACE
+		trace_start(trace_name);
+#else
+		printf("main: built without DECONV_TRACE, -trace is ignored\n");
+#endif
+	}
+
+	need_psf = false;
+	for (n = 0; n < batch.step_count; n++) {
+		if (batch.steps[n].operation >= STEP_CONV) {
+			need_psf = true;
+		}
+	}
+	if (need_psf) {
+		if (psf_name == 0) {
+			printf("main: the steps need a PSF (-psf file)\n");
+			return 1;
+		}
+		batch.psf = loadImage(psf_name, _file_type(psf_name));
+		if (batch.psf == 0) {
+			return 1;
+		}
+		grayscale(batch.psf);
+	}
+
+	//    ,       
+	// .     
+	if (workers > 0) {
+		set_thread_count(workers);
+	}
+	parallel_for(batch.input_count, _batch_range, &batch);
 
+	printf("main: %d of %d files processed\n", batch.input_count - batch.failed, batch.input_count);
+	for (n = 0; n < batch.input_count; n++) {
+		delete [] batch.inputs[n];
+	}
+	delete [] batch.inputs;
+	delete [] batch.steps;
+	if (batch.psf != 0) {
+		deleteImage(batch.psf);
+	}
+#ifdef DECONV_TRACE
+	if (trace_name != 0) {
+		trace_stop();
+	}
+#endif
+	return (batch.failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,286 @@
+/*
+ * Thread pool for the data-parallel loops (implementation)
+ */
+
+#include "threads.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+/*
+ * Platform primitives: one lock with two condition variables guards the
+ * whole pool.
+ */
+#ifdef _WIN32
+
+static CRITICAL_SECTION pool_section;
+static CONDITION_VARIABLE work_ready, work_done;
+
+// The primitives are set up before main() starts
+static struct POOL_INIT {
+   POOL_INIT()
+   {
+      InitializeCriticalSection(&pool_section);
+      InitializeConditionVariable(&work_ready);
+      InitializeConditionVariable(&work_done);
+   }
+} pool_init;
+
+static void pool_lock() { EnterCriticalSection(&pool_section); }
+static void pool_unlock() { LeaveCriticalSection(&pool_section); }
+
+static void pool_wait(CONDITION_VARIABLE *cond)
+{
+   SleepConditionVariableCS(cond, &pool_section, INFINITE);
+}
+
+static void pool_wake(CONDITION_VARIABLE *cond)
+{
+   WakeAllConditionVariable(cond);
+}
+
+static int processor_count()
+{
+   SYSTEM_INFO info;
+   GetSystemInfo(&info);
+   return (int)info.dwNumberOfProcessors;
+}
+
+#else
+
+static pthread_mutex_t pool_section = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t work_done = PTHREAD_COND_INITIALIZER;
+
+static void pool_lock() { pthread_mutex_lock(&pool_section); }
+static void pool_unlock() { pthread_mutex_unlock(&pool_section); }
+
+static void pool_wait(pthread_cond_t *cond)
+{
+   pthread_cond_wait(cond, &pool_section);
+}
+
+static void pool_wake(pthread_cond_t *cond)
+{
+   pthread_cond_broadcast(cond);
+}
+
+static int processor_count()
+{
+   long count = sysconf(_SC_NPROCESSORS_ONLN);
+   return count > 0 ? (int)count : 1;
+}
+
+#endif
+
+/*
+ * The current job.  Ranges are handed out in order under the lock; the job
+ * is over when every range is taken and no thread is still working.
+ */
+static int requested_threads = 0;
+static int started_workers = 0;
+static bool busy = false;
+static unsigned int generation = 0;
+static RANGE_FUNCTION job_func;
+static void *job_context;
+static int job_count, job_chunk, job_next, job_active;
+
+/*
+ * Takes ranges of the current job until none is left.  Called with the
+ * lock held.
+ */
+static void run_ranges()
+{
+   job_active++;
+   while(job_next < job_count) {
+      int begin = job_next;
+      int end = begin + job_chunk;
+      if(end > job_count)
+         end = job_count;
+      job_next = end;
+      pool_unlock();
+      job_func(job_context, begin, end);
+      pool_lock();
+   }
+   job_active--;
+   if(job_active == 0)
+      pool_wake(&work_done);
+}
+
+/*
+ * Worker loop.  Workers beyond the current thread count sit out the jobs.
+ */
+static void worker(int index)
+{
+   unsigned int seen = 0;
+
+   pool_lock();
+   for(;;) {
+      while(generation == seen)
+         pool_wait(&work_ready);
+      seen = generation;
+      if(index < thread_count() - 1)
+         run_ranges();
+   }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI worker_entry(LPVOID param)
+{
+   worker((int)(INT_PTR)param);
+   return 0;
+}
+#else
+static void *worker_entry(void *param)
+{
+   worker((int)(long)param);
+   return 0;
+}
+#endif
+
+/*
+ * Starts workers up to the given number.  Called with the lock held.
+ */
+static void start_workers(int count)
+{
+   for(; started_workers < count; started_workers++) {
+#ifdef _WIN32
+      HANDLE thread = CreateThread(0, 0, worker_entry,
+                                   (LPVOID)(INT_PTR)started_workers, 0, 0);
+      if(thread == 0)
+         break;
+      CloseHandle(thread);
+#else
+      pthread_t thread;
+      if(pthread_create(&thread, 0, worker_entry,
+                        (void *)(long)started_workers) != 0)
+         break;
+      pthread_detach(thread);
+#endif
+   }
+}
+
+void set_thread_count(int count)
+{
+   requested_threads = count > 0 ? count : 0;
+}
+
+int thread_count()
+{
+   return requested_threads > 0 ? requested_threads : processor_count();
+}
+
+bool parallel_busy()
+{
+   pool_lock();
+   bool result = busy;
+   pool_unlock();
+   return result;
+}
+
+void parallel_for(int count, RANGE_FUNCTION func, void *context)
+{
+   if(count <= 0)
+      return;
+   int threads = thread_count();
+   if(threads == 1 || count == 1) {
+      func(context, 0, count);
+      return;
+   }
+
+   pool_lock();
+   if(busy) {
+      pool_unlock();
+      func(context, 0, count);
+      return;
+   }
+   busy = true;
+   start_workers(threads - 1);
+
+   // A few ranges per thread even out the load of unequal ranges
+   job_func = func;
+   job_context = context;
+   job_count = count;
+   job_chunk = count/(threads*4);
+   if(job_chunk < 1)
+      job_chunk = 1;
+   job_next = 0;
+   generation++;
+   pool_wake(&work_ready);
+
+   run_ranges();
+   while(job_active > 0)
+      pool_wait(&work_done);
+   busy = false;
+   pool_unlock();
+}
+
+/*
+ * Scratch buffers, one set per thread.
+ */
+static THREAD_LOCAL char *scratch_blocks[THREAD_SCRATCH_SLOTS];
+static THREAD_LOCAL size_t scratch_sizes[THREAD_SCRATCH_SLOTS];
+
+void *thread_scratch(int slot, size_t size)
+{
+   if(scratch_sizes[slot] < size) {
+      delete[] scratch_blocks[slot];
+      scratch_blocks[slot] = 0;
+      scratch_sizes[slot] = 0;
+      scratch_blocks[slot] = new char[size];
+      scratch_sizes[slot] = size;
+   }
+   return scratch_blocks[slot];
+}
+
+/*
+ * Mutex
+ */
+#ifdef _WIN32
+
+MUTEX::MUTEX()
+{
+   CRITICAL_SECTION *section = new CRITICAL_SECTION;
+   InitializeCriticalSection(section);
+   handle = section;
+}
+
+MUTEX::~MUTEX()
+{
+   DeleteCriticalSection((CRITICAL_SECTION *)handle);
+   delete (CRITICAL_SECTION *)handle;
+}
+
+void MUTEX::lock() { EnterCriticalSection((CRITICAL_SECTION *)handle); }
+void MUTEX::unlock() { LeaveCriticalSection((CRITICAL_SECTION *)handle); }
+
+#else
+
+MUTEX::MUTEX()
+{
+   pthread_mutex_t *mutex = new pthread_mutex_t;
+   pthread_mutex_init(mutex, 0);
+   handle = mutex;
+}
+
+MUTEX::~MUTEX()
+{
+   pthread_mutex_destroy((pthread_mutex_t *)handle);
+   delete (pthread_mutex_t *)handle;
+}
+
+void MUTEX::lock() { pthread_mutex_lock((pthread_mutex_t *)handle); }
+void MUTEX::unlock() { pthread_mutex_unlock((pthread_mutex_t *)handle); }
+
+#endif
@@ -0,0 +1,51 @@
+/*
+ * Thread pool for the data-parallel loops
+ */
+
+#ifndef __THREADS_H__
+#define __THREADS_H__
+
+#include <stddef.h>
+
+#define THREAD_SCRATCH_SLOTS 4
+
+// Body of a parallel loop: handles the indices begin ... end - 1
+typedef void (*RANGE_FUNCTION)(void *context, int begin, int end);
+
+// Sets the number of threads used by parallel_for(), including the calling
+// thread. 0 means one thread per processor (the default)
+void set_thread_count(int count);
+
+// Returns the number of threads used by parallel_for()
+int thread_count();
+
+// True while the pool is running a job, so that a parallel_for() called now
+// runs on the calling thread alone
+bool parallel_busy();
+
+// Splits [0, count) into disjoint ranges and calls ``func'' on every range,
+// using the pool threads and the calling thread. Returns when all the ranges
+// are done. Every index is handled by the same code no matter which thread
+// takes it, so the results do not depend on the number of threads. A call
+// made while the pool is busy runs on the calling thread alone
+void parallel_for(int count, RANGE_FUNCTION func, void *context);
+
+// Scratch memory of the calling thread: a buffer of at least ``size'' bytes
+// that stays valid until the next call with the same slot on the same
+// thread. Buffers only grow and are kept for the life of the thread, so
+// repeated loops over images of one size stop allocating after the first
+// call. ``slot'' is below THREAD_SCRATCH_SLOTS; nested users take different
+// slots
+void *thread_scratch(int slot, size_t size);
+
+// Mutual exclusion for shared caches
+struct MUTEX {
+   MUTEX();
+   ~MUTEX();
+   void lock();
+   void unlock();
+
+   void *handle;
+};
+
+#endif
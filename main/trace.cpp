@@ -0,0 +1,237 @@
+/*
+ * Tracing of the hot paths (implementation)
+ */
+
+#include "trace.h"
+
+#ifdef DECONV_TRACE
+
+#include "threads.h"
+#include <stdio.h>
+#include <math.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#define TRACE_THREAD_LOCAL __declspec(thread)
+#else
+#include <sys/time.h>
+#define TRACE_THREAD_LOCAL __thread
+#endif
+
+static const char *counter_names[TRACE_COUNTERS] = { "flops", "bytes", "fft_calls" };
+
+// One finished timer
+struct TRACE_EVENT {
+   const char *name;
+   std::string note;
+   int thread;
+   double start, duration;           // Microseconds from trace_start()
+   double counters[TRACE_COUNTERS];  // Work done by the thread in the block
+   double memory;                    // Memory high-water mark above the start
+};
+
+/*
+ * The recorded events and the totals of the run, guarded by trace_mutex.
+ * Every thread keeps its own counters and memory, so a block only sees the
+ * work of its own thread.
+ */
+static MUTEX trace_mutex;
+static bool tracing = false;
+static std::string trace_name;
+static double trace_origin;
+static std::vector<TRACE_EVENT> events;
+static double totals[TRACE_COUNTERS];
+static double total_memory, total_peak;
+static int thread_total = 0;
+
+static TRACE_THREAD_LOCAL int thread_index = -1;
+static TRACE_THREAD_LOCAL double thread_counters[TRACE_COUNTERS];
+static TRACE_THREAD_LOCAL double thread_memory, thread_peak;
+
+/*
+ * Wall-clock time in microseconds.
+ */
+static double trace_clock()
+{
+#ifdef _WIN32
+   LARGE_INTEGER counter, frequency;
+   QueryPerformanceCounter(&counter);
+   QueryPerformanceFrequency(&frequency);
+   return 1e6*(double)counter.QuadPart/(double)frequency.QuadPart;
+#else
+   struct timeval now;
+   gettimeofday(&now, 0);
+   return 1e6*now.tv_sec + now.tv_usec;
+#endif
+}
+
+/*
+ * Small number of the calling thread, given out on first use.
+ */
+static int current_thread()
+{
+   if(thread_index < 0) {
+      trace_mutex.lock();
+      thread_index = thread_total++;
+      trace_mutex.unlock();
+   }
+   return thread_index;
+}
+
+void trace_start(const char *name)
+{
+   trace_mutex.lock();
+   trace_name = name;
+   trace_origin = trace_clock();
+   events.clear();
+   for(int i = 0; i < TRACE_COUNTERS; i++)
+      totals[i] = 0;
+   total_peak = total_memory;
+   tracing = true;
+   trace_mutex.unlock();
+}
+
+/*
+ * Writes a JSON string, escaping quotes, backslashes and control characters.
+ */
+static void write_string(FILE *file, const char *text)
+{
+   fputc('"', file);
+   for(; *text != 0; text++) {
+      unsigned char c = (unsigned char)*text;
+      if(c == '"' || c == '\\')
+         fprintf(file, "\\%c", c);
+      else if(c < 0x20)
+         fprintf(file, "\\u%04x", c);
+      else
+         fputc(c, file);
+   }
+   fputc('"', file);
+}
+
+bool trace_stop()
+{
+   trace_mutex.lock();
+   tracing = false;
+   FILE *file = fopen(trace_name.c_str(), "w");
+   if(file != 0) {
+      fprintf(file, "{\"traceEvents\":[\n");
+      for(int t = 0; t < thread_total; t++) {
+         fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                 "\"args\":{\"name\":\"thread %d\"}},\n", t, t);
+      }
+      for(size_t n = 0; n < events.size(); n++) {
+         const TRACE_EVENT &event = events[n];
+         fprintf(file, "{\"name\":");
+         write_string(file, event.name);
+         fprintf(file, ",\"cat\":\"deconv\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                 "\"ts\":%.3f,\"dur\":%.3f,\"args\":{", event.thread,
+                 event.start, event.duration);
+         if(!event.note.empty()) {
+            fprintf(file, "\"note\":");
+            write_string(file, event.note.c_str());
+            fprintf(file, ",");
+         }
+         for(int i = 0; i < TRACE_COUNTERS; i++)
+            fprintf(file, "\"%s\":%.0f,", counter_names[i], event.counters[i]);
+         fprintf(file, "\"memory_peak\":%.0f}}%s\n", event.memory,
+                 (n + 1 < events.size()) ? "," : "");
+      }
+      fprintf(file, "],\"displayTimeUnit\":\"ms\"}\n");
+      fclose(file);
+   }
+   printf("trace: %d events, %.3g GFLOP, %.3g GB, %.0f transforms, "
+          "peak memory %.1f MB\n", (int)events.size(), totals[TRACE_FLOPS]/1e9,
+          totals[TRACE_BYTES]/1e9, totals[TRACE_FFT_CALLS], total_peak/1048576.0);
+   if(file == 0)
+      printf("trace: cannot write %s\n", trace_name.c_str());
+   events.clear();
+   trace_mutex.unlock();
+   return file != 0;
+}
+
+void trace_count(int counter, double amount)
+{
+   thread_counters[counter] += amount;
+   if(tracing) {
+      trace_mutex.lock();
+      totals[counter] += amount;
+      trace_mutex.unlock();
+   }
+}
+
+void trace_fft(int points, bool real)
+{
+   double flops = 5.0*points*log((double)points)/log(2.0);
+   trace_count(TRACE_FFT_CALLS, 1);
+   trace_count(TRACE_FLOPS, real ? flops/2 : flops);
+   trace_count(TRACE_BYTES, real ? 16.0*points : 32.0*points);
+}
+
+void trace_alloc(double bytes)
+{
+   thread_memory += bytes;
+   if(thread_memory > thread_peak)
+      thread_peak = thread_memory;
+   trace_mutex.lock();
+   total_memory += bytes;
+   if(total_memory > total_peak)
+      total_peak = total_memory;
+   trace_mutex.unlock();
+}
+
+void trace_free(double bytes)
+{
+   thread_memory -= bytes;
+   trace_mutex.lock();
+   total_memory -= bytes;
+   trace_mutex.unlock();
+}
+
+/*
+ * The timer saves the counters of its thread and starts a new high-water
+ * mark; the outer mark is restored when the block ends.
+ */
+TRACE_TIMER::TRACE_TIMER(const char *name, const char *note)
+   : name(name), note(note)
+{
+   active = tracing;
+   if(!active)
+      return;
+   for(int i = 0; i < TRACE_COUNTERS; i++)
+      counters[i] = thread_counters[i];
+   memory = thread_memory;
+   outer_peak = thread_peak;
+   thread_peak = thread_memory;
+   start = trace_clock();
+}
+
+TRACE_TIMER::~TRACE_TIMER()
+{
+   if(!active)
+      return;
+   TRACE_EVENT event;
+   event.name = name;
+   if(note != 0)
+      event.note = note;
+   event.thread = current_thread();
+   event.start = start - trace_origin;
+   event.duration = trace_clock() - start;
+   for(int i = 0; i < TRACE_COUNTERS; i++)
+      event.counters[i] = thread_counters[i] - counters[i];
+   event.memory = thread_peak - memory;
+   if(thread_peak < outer_peak)
+      thread_peak = outer_peak;
+
+   trace_mutex.lock();
+   if(tracing)
+      events.push_back(event);
+   trace_mutex.unlock();
+}
+
+#endif
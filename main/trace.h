@@ -0,0 +1,75 @@
+/*
+ * Tracing of the hot paths: scoped timers, work counters and memory
+ * high-water marks, written as a Chrome trace (chrome://tracing, Perfetto)
+ *
+ * Everything is compiled in only when DECONV_TRACE is defined (/D
+ * DECONV_TRACE or -DDECONV_TRACE).  Otherwise every macro below expands to
+ * nothing, so the arguments are not even evaluated.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#define TRACE_FLOPS 0      // Floating-point operations (estimated)
+#define TRACE_BYTES 1      // Bytes of the arrays read and written
+#define TRACE_FFT_CALLS 2  // Two-dimensional transforms
+#define TRACE_COUNTERS 3
+
+#ifdef DECONV_TRACE
+
+// Starts recording.  The events are written to the file ``name'' by
+// trace_stop()
+void trace_start(const char *name);
+
+// Stops recording, writes the trace file and prints the totals.  Returns
+// false if the file could not be written
+bool trace_stop();
+
+// Adds ``amount'' to a counter of the calling thread
+void trace_count(int counter, double amount);
+
+// Counts a transform of ``points'' numbers: 5*N*log2(N) operations for
+// complex numbers, half as many for real ones
+void trace_fft(int points, bool real);
+
+// Memory of the calling thread: ``bytes'' more or less in use
+void trace_alloc(double bytes);
+void trace_free(double bytes);
+
+// Times the enclosing block.  The event gets the counters and the memory
+// high-water mark of the thread within the block.  ``name'' must live until
+// trace_stop() (a string literal), ``note'' is copied
+struct TRACE_TIMER {
+   TRACE_TIMER(const char *name, const char *note = 0);
+   ~TRACE_TIMER();
+
+   const char *name;
+   const char *note;
+   bool active;
+   double start;
+   double counters[TRACE_COUNTERS];
+   double memory;
+   double outer_peak;
+};
+
+#define TRACE_JOIN2(a, b) a##b
+#define TRACE_JOIN(a, b) TRACE_JOIN2(a, b)
+#define TRACE_SCOPE(name) TRACE_TIMER TRACE_JOIN(trace_timer_, __LINE__)(name)
+#define TRACE_SCOPE_NOTE(name, note) TRACE_TIMER TRACE_JOIN(trace_timer_, __LINE__)(name, note)
+#define TRACE_COUNT(counter, amount) trace_count(counter, amount)
+#define TRACE_FFT(points, real) trace_fft(points, real)
+#define TRACE_ALLOC(bytes) trace_alloc(bytes)
+#define TRACE_FREE(bytes) trace_free(bytes)
+
+#else
+
+#define TRACE_SCOPE(name)
+#define TRACE_SCOPE_NOTE(name, note)
+#define TRACE_COUNT(counter, amount)
+#define TRACE_FFT(points, real)
+#define TRACE_ALLOC(bytes)
+#define TRACE_FREE(bytes)
+
+#endif
+
+#endif